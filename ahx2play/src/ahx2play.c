@@ -17,27 +17,40 @@
 #define DEFAULT_MASTER_VOL 256
 #define DEFAULT_STEREO_SEPARATION 10
 #define DEFAULT_WAVRENDER_LOOPS 0
+#define DEFAULT_WAVRENDER_THREADS 1
+#define DEFAULT_MIXER_QUALITY PAULA_QUALITY_BLEP
+#define DEFAULT_LOOKAHEAD_TICKS 0
 
 // set to true if you want ahx2play to always render to WAV
 #define DEFAULT_WAVRENDER_MODE_FLAG false
 
+#define MAX_LOOKAHEAD_TICKS 250 /* 5 seconds at 50Hz */
+
 // default settings
-static bool renderToWavFlag = DEFAULT_WAVRENDER_MODE_FLAG;
+static bool renderToWavFlag = DEFAULT_WAVRENDER_MODE_FLAG, renderToTraceFlag = false;
 static int32_t stereoSeparation = DEFAULT_STEREO_SEPARATION;
 static int32_t masterVolume = DEFAULT_MASTER_VOL;
 static int32_t audioFrequency = DEFAULT_AUDIO_FREQ;
 static int32_t audioBufferSize = DEFAULT_AUDIO_BUFSIZE;
 static int32_t WAVSongLoopTimes = DEFAULT_WAVRENDER_LOOPS;
+static int32_t WAVRenderThreads = DEFAULT_WAVRENDER_THREADS;
+static int32_t mixerQuality = DEFAULT_MIXER_QUALITY;
+static int32_t lookaheadTicks = DEFAULT_LOOKAHEAD_TICKS;
 // ----------------------------------------------------------
 
 static volatile bool programRunning;
 static char *filename, *WAVRenderFilename;
 static int32_t oldStereoSeparation;
+static ahxRenderJob_t *renderJob;
+static ahxTrace_t *trace; // if the input file is a Paula trace
 
 static void showUsage(void);
 static void handleArguments(int argc, char *argv[]);
 static void readKeyboard(void);
 static int32_t renderToWav(void);
+static int32_t renderToWavParallel(void);
+static int32_t renderToTrace(void);
+static int32_t playTrace(void);
 
 // yuck!
 #ifdef _WIN32
@@ -47,7 +60,56 @@ static void *wavRecordingThread(void *arg)
 #endif
 {
 	// 8bb: put this in a thread so that it can be cancelled at any time by pressing a key (it can get stuck in a loop)
-	ahxRecordWAV(filename, WAVRenderFilename, 0, WAVSongLoopTimes, audioFrequency, masterVolume, stereoSeparation);
+	if (trace != NULL)
+		ahxRecordTraceWAV(trace, WAVRenderFilename, audioFrequency, masterVolume, stereoSeparation);
+	else
+		ahxRecordWAV(filename, WAVRenderFilename, 0, WAVSongLoopTimes, audioFrequency, masterVolume, stereoSeparation);
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+
+	(void)arg;
+}
+
+// renders every WAVRenderThreads'th chunk of renderJob, starting at chunk number arg
+#ifdef _WIN32
+static DWORD WINAPI wavChunkThread(LPVOID arg)
+#else
+static void *wavChunkThread(void *arg)
+#endif
+{
+	// every thread needs its own context (with the same settings as the one renderJob was made with)
+	ahx_context_t *ctx = ahxCreateContext(audioFrequency, masterVolume, stereoSeparation, PAULA_QUALITY_BLEP);
+	if (ctx != NULL && ahxLoadCtx(ctx, filename))
+	{
+		const int32_t numChunks = ahxGetRenderJobChunks(renderJob);
+		for (int32_t i = (int32_t)(intptr_t)arg; i < numChunks; i += WAVRenderThreads)
+			ahxRenderJobChunkCtx(ctx, renderJob, i); // chunks that failed are rendered in ahxFinishRenderJobCtx()
+	}
+	ahxDestroyContext(ctx);
+
+#ifdef _WIN32
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+// runs the replayer ahead of the audio output, if a lookahead was set
+#ifdef _WIN32
+static DWORD WINAPI replayerThread(LPVOID arg)
+#else
+static void *replayerThread(void *arg)
+#endif
+{
+	while (programRunning)
+	{
+		ahxRunLookahead();
+		Sleep(5);
+	}
 
 #ifdef _WIN32
 	return 0;
@@ -85,11 +147,20 @@ int main(int argc, char *argv[])
 	handleArguments(argc, argv);
 #endif
 
+	trace = ahxLoadTrace(filename); // NULL if it's a module
+	if (renderToTraceFlag && trace == NULL)
+		return renderToTrace();
+
 	if (renderToWavFlag)
-		return renderToWav();
+	{
+		const int32_t result = renderToWav();
+
+		ahxFreeTrace(trace);
+		return result;
+	}
 
 	// Initialize AHX system
-	if (!ahxInit(audioFrequency, audioBufferSize, masterVolume, stereoSeparation))
+	if (!ahxInit(audioFrequency, audioBufferSize, masterVolume, stereoSeparation, mixerQuality))
 	{
 		ahxClose();
 
@@ -110,6 +181,16 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (lookaheadTicks > 0 && !ahxSetLookahead(lookaheadTicks))
+	{
+		ahxClose();
+		printf("Error initializing AHX replayer: Out of memory!\n");
+		return 1;
+	}
+
+	if (trace != NULL)
+		return playTrace();
+
 	// Load song
 	if (!ahxLoad(filename))
 	{
@@ -140,6 +221,10 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// Get song length (dry run of the replayer, stops playback)
+	songDuration_t duration;
+	ahxGetSongDuration(0, 0, audioFrequency, &duration);
+
 	// Play song (start at song #0)
 	if (!ahxPlay(0))
 	{
@@ -170,6 +255,9 @@ int main(int argc, char *argv[])
 	sigaction(SIGTERM, &action, NULL);
 #endif
 
+	const song_t *song = ahxGetSong();
+	const audio_t *audio = paulaGetAudio();
+
 	printf("Controls:\n");
 	printf("    Esc = Quit\n");
 	printf("      r = Restart song\n");
@@ -180,18 +268,29 @@ int main(int argc, char *argv[])
 	printf("      p = Previous sub-song (if any)\n");
 	printf("      h = Toggle Amiga hard-panning\n");
 	printf("\n");
-	printf("Master volume: %d (%d%%)\n", audio.masterVol, (int32_t)((audio.masterVol / 256.0) * 100));
-	printf("Audio output frequency: %dHz\n", audio.outputFreq);
-	printf("Initial stereo separation: %d%%\n", audio.stereoSeparation);
+	printf("Master volume: %d (%d%%)\n", audio->masterVol, (int32_t)((audio->masterVol / 256.0) * 100));
+	printf("Audio output frequency: %dHz\n", audio->outputFreq);
+	printf("Initial stereo separation: %d%%\n", audio->stereoSeparation);
+	if (lookaheadTicks > 0)
+		printf("Replayer lookahead: %d ticks\n", lookaheadTicks);
 	printf("\n");
 	printf("- SONG INFO -\n");
-	printf(" Name: %s\n", song.Name);
-	printf(" Song revision: v%d\n", song.Revision);
-	printf(" Sub-songs: %d\n", song.Subsongs);
-	printf(" Song length: %d (restart pos: %d)\n", song.LenNr, song.ResNr);
-	printf(" Song tick rate: %.4fHz (%.2f BPM)\n", song.dBPM / 2.5, song.dBPM);
-	printf(" Track length: %d\n", song.TrackLength);
-	printf(" Instruments: %d\n", song.numInstruments);
+	printf(" Name: %s\n", song->Name);
+	printf(" Song revision: v%d\n", song->Revision);
+	printf(" Sub-songs: %d\n", song->Subsongs);
+	printf(" Song length: %d (restart pos: %d)\n", song->LenNr, song->ResNr);
+	if (duration.ended)
+	{
+		const int32_t seconds = (int32_t)(duration.numSamples / audio->outputFreq);
+		printf(" Duration: %d:%02d\n", seconds / 60, seconds % 60);
+	}
+	else
+	{
+		printf(" Duration: endless\n");
+	}
+	printf(" Song tick rate: %.4fHz (%.2f BPM)\n", song->dBPM / 2.5, song->dBPM);
+	printf(" Track length: %d\n", song->TrackLength);
+	printf(" Instruments: %d\n", song->numInstruments);
 	printf("\n");
 	printf("- STATUS -\n");
 
@@ -200,16 +299,19 @@ int main(int argc, char *argv[])
 #endif
 	hideTextCursor();
 
-	oldStereoSeparation = audio.stereoSeparation; // for toggling separation with 'h' key
+	oldStereoSeparation = audio->stereoSeparation; // for toggling separation with 'h' key
 
 	programRunning = true;
+	if (lookaheadTicks > 0 && !createWorkerThread(replayerThread, NULL))
+		ahxSetLookahead(0); // let the audio callback run the replayer then
+
 	while (programRunning)
 	{
 		readKeyboard();
 
 		printf(" Pos: %03d/%03d - Row: %02d/%02d - Speed: %d %s               \r",
-			song.PosNr, song.LenNr, song.NoteNr, song.TrackLength, song.Tempo,
-			audio.pause ? "(PAUSED)" : "");
+			song->PosNr, song->LenNr, song->NoteNr, song->TrackLength, song->Tempo,
+			audio->pause ? "(PAUSED)" : "");
 
 		fflush(stdout);
 		Sleep(50);
@@ -221,6 +323,8 @@ int main(int argc, char *argv[])
 #endif
 	showTextCursor();
 
+	closeWorkerThreads(); // the replayer thread, if any
+
 	// Free loaded song
 	ahxFree();
 
@@ -235,21 +339,35 @@ static void showUsage(void)
 {
 	printf("Usage:\n");
 	printf("  ahx2play input_module [-f hz] [-m mixingvol] [-b buffersize]\n");
-	printf("  ahx2play input_module [-s percentage] [--render-to-wav] [-wloop loops]\n");
+	printf("  ahx2play input_module [-s percentage] [-q quality] [-l ticks] [--render-to-wav] [-wloop loops] [-t threads]\n");
+	printf("  ahx2play input_module [--render-to-trace] [-wloop loops]\n");
 	printf("\n");
 	printf("  Options:\n");
-	printf("    input_module     Specifies the module file to load (.AHX/.THX)\n");
-	printf("    -f hz            Specifies the audio frequency (32000..384000)\n");
+	printf("    input_module     Specifies the module file to load (.AHX/.THX), or a Paula\n");
+	printf("                     trace (.AHT) to play or render to WAV.\n");
+	printf("    -f hz            Specifies the audio frequency (8000..384000)\n");
 	printf("    -m mastervol     Specifies the master volume (0..256)\n");
 	printf("    -b buffersize    Specifies the audio buffer size (256..8192)\n");
 	printf("    -s percentage    Specifies the stereo separation (0..100).\n");
 	printf("                     0 = mono, 100 = Amiga hard-panning.\n");
+	printf("    -q quality       Specifies the mixer quality (0..2). 0 = BLEP synthesis,\n");
+	printf("                     1 = short BLEPs, 2 = no BLEPs (cheapest, more aliasing).\n");
+	printf("                     WAV rendering always uses 0.\n");
+	printf("    -l ticks         Runs the replayer on its own thread, up to this many ticks\n");
+	printf("                     (1..%d) ahead of the audio output. 0 = in the audio callback.\n", MAX_LOOKAHEAD_TICKS);
 	printf("    --render-to-wav  Renders song to WAV instead of playing it. The output\n");
 	printf("                     filename will be the input filename with .WAV added to the\n");
 	printf("                     end.\n");
 	printf("    --wloop loops    Specifies how many times to loop the song during WAV write.\n");
 	printf("                     Parameter 0 = no loop, 1 = loop 1 time, etc.\n");
 	printf("                     Any F00 command will stop the song regardless of setting.\n");
+	printf("    -t threads       Specifies how many threads to render the WAV with (1..%d).\n", MAX_WORKER_THREADS);
+	printf("                     The output is the same, but can't be stopped with a key.\n");
+	printf("    --render-to-trace\n");
+	printf("                     Records the song's Paula writes to a trace instead of\n");
+	printf("                     playing it, a small file that plays the same at any audio\n");
+	printf("                     frequency. The output filename will be the input filename\n");
+	printf("                     with .AHT added to the end.\n");
 	printf("\n");
 	printf("Default settings (can only be changed in the source code):\n");
 	printf("  - Audio frequency:          %dHz\n", DEFAULT_AUDIO_FREQ);
@@ -258,6 +376,9 @@ static void showUsage(void)
 	printf("  - Stereo separation:        %d%%\n", DEFAULT_STEREO_SEPARATION);
 	printf("  - WAV render mode:          %s\n", DEFAULT_WAVRENDER_MODE_FLAG ? "On" : "Off");
 	printf("  - WAV song loop times:      %d\n", DEFAULT_WAVRENDER_LOOPS);
+	printf("  - WAV rendering threads:    %d\n", DEFAULT_WAVRENDER_THREADS);
+	printf("  - Mixer quality:            %d\n", DEFAULT_MIXER_QUALITY);
+	printf("  - Replayer lookahead:       %d ticks\n", DEFAULT_LOOKAHEAD_TICKS);
 	printf("\n");
 }
 
@@ -271,7 +392,7 @@ static void handleArguments(int argc, char *argv[])
 			if (!_stricmp(argv[i], "-f") && i+1 < argc)
 			{
 				const int32_t num = atoi(argv[i+1]);
-				audioFrequency = CLAMP(num, 32000, 384000);
+				audioFrequency = CLAMP(num, PAULA_MIN_FREQ, PAULA_MAX_FREQ);
 			}
 			else if (!_stricmp(argv[i], "-m") && i+1 < argc)
 			{
@@ -288,15 +409,34 @@ static void handleArguments(int argc, char *argv[])
 				const int32_t num = atoi(argv[i+1]);
 				stereoSeparation = CLAMP(num, 0, 100);
 			}
+			else if (!_stricmp(argv[i], "-q") && i+1 < argc)
+			{
+				const int32_t num = atoi(argv[i+1]);
+				mixerQuality = CLAMP(num, PAULA_QUALITY_BLEP, PAULA_QUALITY_ZOH);
+			}
+			else if (!_stricmp(argv[i], "-l") && i+1 < argc)
+			{
+				const int32_t num = atoi(argv[i+1]);
+				lookaheadTicks = CLAMP(num, 0, MAX_LOOKAHEAD_TICKS);
+			}
 			else if (!_stricmp(argv[i], "--render-to-wav"))
 			{
 				renderToWavFlag = true;
 			}
+			else if (!_stricmp(argv[i], "--render-to-trace"))
+			{
+				renderToTraceFlag = true;
+			}
 			else if (!_stricmp(argv[i], "-wloops") && i + 1 < argc)
 			{
 				const int32_t num = atoi(argv[i + 1]);
 				WAVSongLoopTimes = CLAMP(num, 0, 100);
 			}
+			else if (!_stricmp(argv[i], "-t") && i+1 < argc)
+			{
+				const int32_t num = atoi(argv[i+1]);
+				WAVRenderThreads = CLAMP(num, 1, MAX_WORKER_THREADS);
+			}
 		}
 	}
 }
@@ -318,27 +458,29 @@ static void readKeyboard(void)
 
 			case 'n': // next sub-song
 			{
-				if (song.Subsongs > 0)
+				const song_t *song = ahxGetSong();
+				if (song->Subsongs > 0)
 				{
-					if (song.Subsong < song.Subsongs)
-						ahxPlay(song.Subsong + 1);
+					if (song->Subsong < song->Subsongs)
+						ahxPlay(song->Subsong + 1);
 				}
 			}
 			break;
 
 			case 'p': // previous sub-song
 			{
-				if (song.Subsongs > 0)
+				const song_t *song = ahxGetSong();
+				if (song->Subsongs > 0)
 				{
-					if (song.Subsong > 0)
-						ahxPlay(song.Subsong - 1);
+					if (song->Subsong > 0)
+						ahxPlay(song->Subsong - 1);
 				}
 			}
 			break;
 
 			case 'h': // toggle Amiga hard-pan
 			{
-				if (audio.stereoSeparation == 100)
+				if (paulaGetAudio()->stereoSeparation == 100)
 					paulaSetStereoSeparation(oldStereoSeparation);
 				else
 					paulaSetStereoSeparation(100);
@@ -376,7 +518,15 @@ static int32_t renderToWav(void)
 	strcpy(WAVRenderFilename, filename);
 	strcat(WAVRenderFilename, ".wav");
 
-	isRecordingToWAV = true; // this is also set in wavRecordingThread(), but do it here to be sure...
+	if (WAVRenderThreads > 1)
+	{
+		const int32_t result = renderToWavParallel();
+
+		free(WAVRenderFilename);
+		return result;
+	}
+
+	ahxSetRecordingWAV(true); // this is also set in wavRecordingThread(), but do it here to be sure...
 	if (!createSingleThread(wavRecordingThread))
 	{
 		printf("Error: Couldn't create WAV rendering thread!\n");
@@ -384,15 +534,15 @@ static int32_t renderToWav(void)
 		return 1;
 	}
 
-	printf("Rendering to WAV. If stuck forever, press any key to stop rendering...\n");
+	printf("Rendering to WAV. Press any key to stop rendering...\n");
 
 #ifndef _WIN32
 	modifyTerminal();
 #endif
-	while (isRecordingToWAV)
+	while (ahxIsRecordingWAV())
 	{
 		if ( _kbhit())
-			isRecordingToWAV = false;
+			ahxSetRecordingWAV(false);
 
 		Sleep(50);
 	}
@@ -407,3 +557,179 @@ static int32_t renderToWav(void)
 	free(WAVRenderFilename);
 	return 0;
 }
+
+static int32_t renderToWavParallel(void)
+{
+	ahx_context_t *ctx = ahxCreateContext(audioFrequency, masterVolume, stereoSeparation, PAULA_QUALITY_BLEP);
+	if (ctx == NULL)
+	{
+		printf("Error: Out of memory!\n");
+		return 1;
+	}
+
+	if (!ahxLoadCtx(ctx, filename))
+	{
+		printf("Error loading AHX module!\n");
+		ahxDestroyContext(ctx);
+		return 1;
+	}
+
+	renderJob = ahxCreateRenderJobCtx(ctx, 0, WAVSongLoopTimes, WAVRenderThreads);
+	if (renderJob == NULL)
+	{
+		printf("Error: Out of memory!\n");
+		ahxDestroyContext(ctx);
+		return 1;
+	}
+
+	printf("Rendering to WAV with %d threads...\n", WAVRenderThreads);
+
+	for (int32_t i = 0; i < WAVRenderThreads; i++)
+	{
+		if (!createWorkerThread(wavChunkThread, (void *)(intptr_t)i))
+			break; // the chunks left are rendered below
+	}
+	closeWorkerThreads();
+
+	int32_t result = 0;
+	if (!ahxFinishRenderJobCtx(ctx, renderJob) || !ahxSaveRenderJobWAV(renderJob, WAVRenderFilename))
+	{
+		printf("Error: Couldn't render WAV!\n");
+		result = 1;
+	}
+
+	ahxFreeRenderJob(renderJob);
+	renderJob = NULL;
+
+	ahxDestroyContext(ctx);
+	return result;
+}
+
+static int32_t renderToTrace(void)
+{
+	ahx_context_t *ctx = ahxCreateContext(audioFrequency, masterVolume, stereoSeparation, PAULA_QUALITY_BLEP);
+	if (ctx == NULL)
+	{
+		printf("Error: Out of memory!\n");
+		return 1;
+	}
+
+	if (!ahxLoadCtx(ctx, filename))
+	{
+		printf("Error loading AHX module!\n");
+		ahxDestroyContext(ctx);
+		return 1;
+	}
+
+	const size_t filenameLen = strlen(filename);
+	char *traceFilename = (char *)malloc(filenameLen+1+3+1);
+	ahxTrace_t *songTrace = ahxCreateTraceCtx(ctx, 0, WAVSongLoopTimes);
+	ahxDestroyContext(ctx);
+
+	if (traceFilename == NULL || songTrace == NULL)
+	{
+		printf("Error: Out of memory!\n");
+		free(traceFilename);
+		ahxFreeTrace(songTrace);
+		return 1;
+	}
+
+	strcpy(traceFilename, filename);
+	strcat(traceFilename, ".aht");
+
+	int32_t result = 0;
+	if (ahxSaveTrace(songTrace, traceFilename))
+	{
+		printf("Wrote %s (%u ticks, %u bytes)\n", traceFilename, ahxGetTraceTicks(songTrace), ahxGetTraceSize(songTrace));
+	}
+	else
+	{
+		printf("Error: Couldn't write trace!\n");
+		result = 1;
+	}
+
+	free(traceFilename);
+	ahxFreeTrace(songTrace);
+	return result;
+}
+
+static int32_t playTrace(void) // the audio system is initialized
+{
+	ahxPlayTrace(trace);
+
+#ifndef _WIN32
+	struct sigaction action;
+	memset(&action, 0, sizeof (struct sigaction));
+	action.sa_handler = sigtermFunc;
+	sigaction(SIGTERM, &action, NULL);
+#endif
+
+	const audio_t *audio = paulaGetAudio();
+
+	printf("Controls:\n");
+	printf("    Esc = Quit\n");
+	printf("      r = Restart trace\n");
+	printf("  Space = Toggle pause\n");
+	printf("      h = Toggle Amiga hard-panning\n");
+	printf("\n");
+	printf("Master volume: %d (%d%%)\n", audio->masterVol, (int32_t)((audio->masterVol / 256.0) * 100));
+	printf("Audio output frequency: %dHz\n", audio->outputFreq);
+	printf("Initial stereo separation: %d%%\n", audio->stereoSeparation);
+	printf("\n");
+	printf("- TRACE INFO -\n");
+	printf(" Ticks: %u\n", ahxGetTraceTicks(trace));
+	printf(" Size: %u bytes\n", ahxGetTraceSize(trace));
+	printf("\n");
+
+#ifndef _WIN32
+	modifyTerminal();
+#endif
+	hideTextCursor();
+
+	oldStereoSeparation = audio->stereoSeparation;
+
+	programRunning = true;
+	if (lookaheadTicks > 0 && !createWorkerThread(replayerThread, NULL))
+		ahxSetLookahead(0);
+
+	while (programRunning)
+	{
+		if (_kbhit())
+		{
+			const int32_t key = _getch();
+			if (key == 0x1B) // esc
+			{
+				programRunning = false;
+			}
+			else if (key == 'r') // restart
+			{
+				ahxPlayTrace(trace);
+			}
+			else if (key == 'h') // toggle Amiga hard-pan
+			{
+				if (paulaGetAudio()->stereoSeparation == 100)
+					paulaSetStereoSeparation(oldStereoSeparation);
+				else
+					paulaSetStereoSeparation(100);
+			}
+			else if (key == 0x20) // space (toggle pause)
+			{
+				paulaTogglePause();
+			}
+		}
+
+		Sleep(50);
+	}
+
+#ifndef _WIN32
+	revertTerminal();
+#endif
+	showTextCursor();
+
+	closeWorkerThreads();
+	ahxClose();
+	ahxFreeTrace(trace);
+
+	printf("Playback stopped.\n");
+	return 0;
+}
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "posix.h" // MAX_WORKER_THREADS
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -69,6 +70,35 @@ void closeSingleThread(void)
 	}
 }
 
+static HANDLE hWorkerThreads[MAX_WORKER_THREADS];
+static int32_t numWorkerThreads;
+
+bool createWorkerThread(DWORD (WINAPI *threadFunc)(LPVOID arg), void *arg)
+{
+	DWORD dwThreadId;
+
+	if (numWorkerThreads >= MAX_WORKER_THREADS)
+		return false;
+
+	const HANDLE handle = CreateThread(NULL, 0, threadFunc, arg, 0, &dwThreadId);
+	if (handle == NULL)
+		return false;
+
+	hWorkerThreads[numWorkerThreads++] = handle;
+	return true;
+}
+
+void closeWorkerThreads(void)
+{
+	for (int32_t i = 0; i < numWorkerThreads; i++)
+	{
+		WaitForSingleObject(hWorkerThreads[i], INFINITE);
+		CloseHandle(hWorkerThreads[i]);
+	}
+
+	numWorkerThreads = 0;
+}
+
 #else
 
 #include <unistd.h>
@@ -111,6 +141,30 @@ void closeSingleThread(void)
 	}
 }
 
+static pthread_t workerThreadIds[MAX_WORKER_THREADS];
+static int32_t numWorkerThreads;
+
+bool createWorkerThread(void *(*threadFunc)(void *arg), void *arg)
+{
+	if (numWorkerThreads >= MAX_WORKER_THREADS)
+		return false;
+
+	const int32_t err = pthread_create(&workerThreadIds[numWorkerThreads], NULL, threadFunc, arg);
+	if (err)
+		return false;
+
+	numWorkerThreads++;
+	return true;
+}
+
+void closeWorkerThreads(void)
+{
+	for (int32_t i = 0; i < numWorkerThreads; i++)
+		pthread_join(workerThreadIds[i], NULL);
+
+	numWorkerThreads = 0;
+}
+
 // the following routines were found on google, and were modified
 
 void modifyTerminal(void)
@@ -7,6 +7,9 @@ void hideTextCursor(void);
 void showTextCursor(void);
 
 void closeSingleThread(void);
+void closeWorkerThreads(void); // waits for all worker threads to finish
+
+#define MAX_WORKER_THREADS 64
 
 #ifdef _WIN32 
 
@@ -15,6 +18,7 @@ void closeSingleThread(void);
 #include <conio.h> // _kbhit(), _getch()
 
 bool createSingleThread(DWORD (WINAPI *threadFunc)(LPVOID arg));
+bool createWorkerThread(DWORD (WINAPI *threadFunc)(LPVOID arg), void *arg);
 
 #else
 
@@ -22,6 +26,7 @@ bool createSingleThread(DWORD (WINAPI *threadFunc)(LPVOID arg));
 #define _strnicmp strncasecmp
 
 bool createSingleThread(void *(*threadFunc)(void *arg));
+bool createWorkerThread(void *(*threadFunc)(void *arg), void *arg);
 
 #include <signal.h>
 #include <stdio.h>
@@ -0,0 +1,69 @@
+#pragma once
+
+/* Internal header! Only to be included by the replayer/loader/Paula code.
+** Applications only see ahx_context_t as an opaque handle (replayer.h).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "paula.h"
+#include "replayer.h"
+
+// square waves (filter position 0..63, width 0..31, wavelength 0..5), repeated over a voice buffer
+#define SQUARE_IMAGES (64*32*6)
+
+// ditto for triangles and sawtooths (filter position 0..63, waveform 0..1, wavelength 0..5)
+#define WAVE_IMAGES (64*2*6)
+
+typedef struct // what a Paula trace has written so far, see replayer.c
+{
+	uint16_t period[AMIGA_VOICES];
+	uint8_t volume[AMIGA_VOICES]; // as Paula uses it (0..64)
+	int8_t voiceBuffer[AMIGA_VOICES][PAULA_VOICE_BUFFER_SIZE];
+} traceVoices_t;
+
+typedef struct // playback position in a Paula trace (see ahxPlayTraceCtx())
+{
+	const ahxTrace_t *trace; // NULL = not playing a trace
+	uint32_t offset, tick, emptyTicks;
+	traceVoices_t voices;
+} tracePlayer_t;
+
+typedef struct // the replayer state from before a tick in the lookahead queue, see ahxRunLookaheadCtx()
+{
+	song_t song;
+	int8_t SquareTempBuffer[AMIGA_VOICES][0x80]; // see voiceBuffers_t
+} lookaheadState_t;
+
+struct ahx_context_t // all the state one player instance needs, nothing is shared between contexts
+{
+	song_t song;
+	const waveforms_t *waves; // dword-aligned, see ahxInitWaves()
+	voiceBuffers_t *buffers; // ditto
+	int8_t **squareImages; // filled in as they're needed, see getSquareImage() in replayer.c
+	int8_t **waveImages; // ditto, see getWaveImage()
+	paula_t paula;
+	tracePlayer_t tracePlayer;
+	loopRow_t *loopRing; // the row states of one loop length, see ahxGetSongDurationCtx()
+	uint32_t loopRingRows;
+	lookaheadState_t *lookaheadStates; // one per lookahead queue entry
+	uint32_t numLookaheadStates;
+
+	volatile bool isRecordingToWAV;
+	bool copyWaveforms; // see ahxSetWaveformCopyingCtx()
+	uint8_t errCode;
+};
+
+// the context that the context-less API (and the audio driver) operates on
+extern ahx_context_t ahxDefaultContext; // replayer.c
+
+// loader.c
+bool ahxInitWaves(ahx_context_t *ctx);
+void ahxFreeWaves(ahx_context_t *ctx);
+
+// waves.c
+void ahxGenerateWaves(waveforms_t *waves);
+
+#ifdef AHX_BAKED_WAVES
+extern const waveforms_t ahxBakedWaves; // generated at build time (see tools/genwaves.c)
+#endif
@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include "replayer.h"
 #include "paula.h"
+#include "ahxcontext.h"
 
 #define SWAP16(x) \
 ( \
@@ -32,260 +33,165 @@
 #define READ_WORD(x, p)  x = *(uint16_t *)p; p += sizeof (uint16_t); x = SWAP16(x)
 #define READ_DWORD(x, p) x = *(uint32_t *)p; p += sizeof (uint32_t); x = SWAP32(x)
 
-extern uint8_t ahxErrCode; // 8bb: replayer.c
-
 // 8bb: AHX-header tempo value (0..3) -> Amiga PAL CIA period
 static const uint16_t tabler[4] = { 14209, 7104, 4736, 3552 };
 
-// 8bb: added +1 to all values in this table (was meant for 68k DBRA loop)
-static const uint16_t lengthTable[6+6+32+1] =
-{
-	0x04,0x08,0x10,0x20,0x40,0x80,
-	0x04,0x08,0x10,0x20,0x40,0x80,
-
-	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
-	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
-	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
-	0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
-
-	NOIZE_SIZE
-};
-
-static void triangleGenerate(int8_t *dst8, int16_t delta, int32_t offset, int32_t length)
+static void freeImages(int8_t ***images, int32_t numImages)
 {
-	int16_t data = 0;
-	for (int32_t i = 0; i < length+1; i++)
-	{
-		*dst8++ = (uint8_t)data;
-		data += delta;
-	}
-	*dst8++ = 127;
-
-	data = 128;
-	for (int32_t i = 0; i < length; i++)
-	{
-		data -= delta;
-		*dst8++ = (uint8_t)data;
-	}
-
-	int8_t *src8 = &dst8[offset];
-	for (int32_t i = 0; i < (length+1)*2; i++)
+	if (*images != NULL)
 	{
-		int8_t sample = *src8++;
-		if (sample == 127)
-			sample = -128;
-		else
-			sample = 0 - sample;
+		for (int32_t i = 0; i < numImages; i++)
+		{
+			if ((*images)[i] != NULL)
+				free((*images)[i]);
+		}
 
-		*dst8++ = sample;
+		free(*images);
+		*images = NULL;
 	}
 }
 
-static void sawToothGenerate(int8_t *dst8, int32_t length)
+void ahxFreeWaves(ahx_context_t *ctx)
 {
-	const int8_t delta = (int8_t)(256 / (length-1));
-
-	int8_t data = -128;
-	for (int32_t i = 0; i < length; i++)
-	{
-		*dst8++ = data;
-		data += delta;
-	}
-}
+#ifndef AHX_BAKED_WAVES
+	if (ctx->waves != NULL)
+		free((waveforms_t *)ctx->waves);
+#endif
+	ctx->waves = NULL;
 
-static void squareGenerate(int8_t *dst8)
-{
-	uint16_t *dst16 = (uint16_t *)dst8;
-	for (int32_t i = 1; i <= 32; i++)
+	if (ctx->buffers != NULL)
 	{
-		for (int32_t j = 0; j < 64-i; j++)
-			*dst16++ = 0x8080;
-
-		for (int32_t j = 0; j < i; j++)
-			*dst16++ = 0x7F7F;
+		free(ctx->buffers);
+		ctx->buffers = NULL;
 	}
-}
-
-static void whiteNoiseGenerate(int8_t *dst8, int32_t length)
-{
-	uint32_t seed = 0x41595321; // 8bb: "AYS!"
 
-	for (int32_t i = 0; i < length; i++)
-	{
-		if (!(seed & 256))
-			*dst8++ = (uint8_t)seed;
-		else if (seed & 0x8000)
-			*dst8++ = -128;
-		else
-			*dst8++ = 127;
-
-		ROR32(seed, 5);
-		seed ^= 0b10011010;
-		uint16_t tmp16 = (uint16_t)seed;
-		ROL32(seed, 2);
-		tmp16 += (uint16_t)seed;
-		seed ^= tmp16;
-		ROR32(seed, 3);
-	}
+	freeImages(&ctx->squareImages, SQUARE_IMAGES);
+	freeImages(&ctx->waveImages, WAVE_IMAGES);
 }
 
-static inline int32_t fp16Clip(int32_t x)
+/* The waveform tables are the same for every context. Built with AHX_BAKED_WAVES, they
+** are generated at build time (see tools/genwaves.c) and linked in as a const object,
+** otherwise every context generates its own. Only the voice buffers are per context.
+*/
+bool ahxInitWaves(ahx_context_t *ctx)
 {
-	int16_t fp16Int = x >> 16;
+	ahxFreeWaves(ctx);
 
-	if (fp16Int > 127)
-	{
-		fp16Int = 127;
-		return fp16Int << 16;
-	}
+	// dword-aligned from calloc(), like the tables. EmptyFilterSection stays zeroed
+	voiceBuffers_t *buffers = (voiceBuffers_t *)calloc(1, sizeof (voiceBuffers_t));
+	if (buffers == NULL)
+		return false;
 
-	if (fp16Int < -128)
+#ifdef AHX_BAKED_WAVES
+	ctx->waves = &ahxBakedWaves;
+#else
+	waveforms_t *waves = (waveforms_t *)malloc(sizeof (waveforms_t));
+	if (waves == NULL)
 	{
-		fp16Int = -128;
-		return fp16Int << 16;
+		free(buffers);
+		return false;
 	}
 
-	return x;
-}
-
-static void setUpFilterWaveForms(void)
-{
-	int8_t *dst8Hi = waves->highPasses;
-	int8_t *dst8Lo = waves->lowPasses;
-	
-	int32_t d5 = ((((8<<16)*125)/100)/100)>>8;
-	for (int32_t i = 0; i < 31; i++)
-	{
-		int8_t *src8 =  waves->triangle04; // 8bb: beginning of waveforms
-		for (int32_t j = 0; j < 6+6+32+1; j++)
-		{
-			const int32_t waveLength = lengthTable[j];
-			
-			int32_t d1;
-			int32_t d2 = 0;
-			int32_t d3 = 0;
-
-			// 8bb: 1st pass
-			for (int32_t k = 0; k < waveLength; k++)
-			{
-				const int32_t d0 = (int16_t)src8[k] << 16;
-
-				d1 = fp16Clip(d0 - d2 - d3);
-				d2 = fp16Clip(d2 + ((d1 >> 8) * d5));
-				d3 = fp16Clip(d3 + ((d2 >> 8) * d5));
-			}
-
-			// 8bb: 2nd pass
-			for (int32_t k = 0; k < waveLength; k++)
-			{
-				const int32_t d0 = (int16_t)src8[k] << 16;
-
-				d1 = fp16Clip(d0 - d2 - d3);
-				d2 = fp16Clip(d2 + ((d1 >> 8) * d5));
-				d3 = fp16Clip(d3 + ((d2 >> 8) * d5));
-			}
-
-			// 8bb: 3rd pass
-			for (int32_t k = 0; k < waveLength; k++)
-			{
-				const int32_t d0 = (int16_t)src8[k] << 16;
-
-				d1 = fp16Clip(d0 - d2 - d3);
-				d2 = fp16Clip(d2 + ((d1 >> 8) * d5));
-				d3 = fp16Clip(d3 + ((d2 >> 8) * d5));
-			}
-			
-			/* 8bb:
-			** Truncate lower 8 bits so that it's bit-accurate
-			** to how AHX does it (it uses a bit-reduced LUT).
-			*/
-			d2 &= ~0xFF;
-			d3 &= ~0xFF;
-
-			// 8bb: 4th pass (also writes to output)
-			for (int32_t k = 0; k < waveLength; k++)
-			{
-				const int32_t d0 = (int16_t)src8[k] << 16;
-
-				d1 = fp16Clip(d0 - d2 - d3);
-				d2 = fp16Clip(d2 + ((d1 >> 8) * d5));
-				d3 = fp16Clip(d3 + ((d2 >> 8) * d5));
-
-				*dst8Hi++ = (uint8_t)(d1 >> 16);
-				*dst8Lo++ = (uint8_t)(d3 >> 16);
-			}
-
-			src8 += waveLength; // 8bb: go to next waveform
-		}
+	ahxGenerateWaves(waves);
+	ctx->waves = waves;
+#endif
 
-		d5 += ((((3<<16)*125)/100)/100)>>8;
-	}
+	ctx->buffers = buffers;
+	return true;
 }
 
-void ahxFreeWaves(void)
+static void decodeTrackRows(trackRow_t *row, const uint8_t *bytes, int32_t numRows)
 {
-	if (waves != NULL)
+	for (int32_t i = 0; i < numRows; i++, row++, bytes += 3)
 	{
-		free(waves);
-		waves = NULL;
+		row->note = (bytes[0] >> 2) & 0x3F;
+		row->instr = ((bytes[0] & 3) << 4) | (bytes[1] >> 4);
+		row->cmd = bytes[1] & 0xF;
+		row->param = bytes[2];
 	}
 }
 
-bool ahxInitWaves(void) // 8bb: this generates bit-accurate AHX 2.3d-sp3 waveforms
+static void decodeInstrument(instrumentData_t *data, const instrument_t *ins)
 {
-	ahxFreeWaves();
-
-	// 8bb: "waves" needs dword-alignment, and that's guaranteed from malloc()
-	waves = (waveforms_t *)malloc(sizeof (waveforms_t));
-	if (waves == NULL)
-		return false;
-
-	// 8bb: generate waveforms
-
-	int8_t *dst8 =  waves->triangle04;
-	for (int32_t i = 0; i < 6; i++)
+	int16_t delta;
+
+	delta = ins->aVolume << 8;
+	if (ins->aFrames != 0)
+		delta /= ins->aFrames;
+	data->aDelta = delta;
+
+	delta = ((int8_t)ins->dVolume - (int8_t)ins->aVolume) << 8;
+	if (ins->dFrames != 0)
+		delta /= ins->dFrames;
+	data->dDelta = delta;
+
+	delta = ((int8_t)ins->rVolume - (int8_t)ins->dVolume) << 8;
+	if (ins->rFrames != 0)
+		delta /= ins->rFrames;
+	data->rDelta = delta;
+
+	data->Wavelength = ins->filterSpeedWavelength & 0b00000111;
+	if (data->Wavelength > 5) // 8bb: safety bug-fix...
+		data->Wavelength = 5;
+
+	data->vibratoDepth = ins->vibratoDepth & 0b00001111;
+	data->HardCutRelease = !!(ins->vibratoDepth & 128);
+	data->HardCut = (ins->vibratoDepth & 0b01110000) >> 4;
+
+	uint8_t lowerLimit = ins->squareLowerLimit >> (5 - data->Wavelength);
+	uint8_t upperLimit = ins->squareUpperLimit >> (5 - data->Wavelength);
+	data->squareLowerLimit = (lowerLimit <= upperLimit) ? lowerLimit : upperLimit;
+	data->squareUpperLimit = (lowerLimit <= upperLimit) ? upperLimit : lowerLimit;
+
+	data->filterSpeed = ins->filterSpeedWavelength >> 3; // shift out wavelength!
+
+	lowerLimit = ins->filterLowerLimit;
+	upperLimit = ins->filterUpperLimit;
+	if (lowerLimit & 128) data->filterSpeed |= 32;
+	if (upperLimit & 128) data->filterSpeed |= 64;
+	lowerLimit &= ~128;
+	upperLimit &= ~128;
+	data->filterLowerLimit = (lowerLimit <= upperLimit) ? lowerLimit : upperLimit;
+	data->filterUpperLimit = (lowerLimit <= upperLimit) ? upperLimit : lowerLimit;
+
+	// 8bb: 4 bytes before perfList (this is apparently what AHX does...)
+	const uint8_t *bytes = ins->perfList - 4;
+
+	perfEntry_t *entry = data->perfEntries;
+	for (int32_t i = 0; i < 1+256; i++, entry++, bytes += 4)
 	{
-		uint16_t fullLength = 4 << i;
-		uint16_t length = fullLength >> 2;
-		uint16_t delta = 128 / length;
-		int32_t offset = 0 - (fullLength >> 1);
-
-		triangleGenerate(dst8, delta, offset, length-1);
-		dst8 += fullLength;
+		entry->cmd2 = (bytes[0] >> 5) & 7;
+		entry->cmd1 = (bytes[0] >> 2) & 7;
+		entry->wave = ((bytes[0] << 1) & 6) | (bytes[1] >> 7);
+		entry->fixed = (bytes[1] >> 6) & 1;
+		entry->note = bytes[1] & 0x3F;
+		entry->param1 = bytes[2];
+		entry->param2 = bytes[3];
 	}
-
-	sawToothGenerate(waves->sawtooth04, 0x04);
-	sawToothGenerate(waves->sawtooth08, 0x08);
-	sawToothGenerate(waves->sawtooth10, 0x10);
-	sawToothGenerate(waves->sawtooth20, 0x20);
-	sawToothGenerate(waves->sawtooth40, 0x40);
-	sawToothGenerate(waves->sawtooth80, 0x80);
-	squareGenerate(waves->squares);
-	whiteNoiseGenerate(waves->whiteNoiseBig, NOIZE_SIZE);
-
-	setUpFilterWaveForms();
-	return true;
 }
 
-static bool ahxInitModule(const uint8_t *p)
+static bool ahxInitModule(ahx_context_t *ctx, const uint8_t *p)
 {
 	bool trkNullEmpty;
 	uint16_t flags;
 
-	song.songLoaded = false;
+	song_t *song = &ctx->song;
+	const waveforms_t *waves = ctx->waves;
+
+	song->songLoaded = false;
 
 	// 8bb: added this check
 	if (waves == NULL)
 	{
-		ahxErrCode = ERR_NO_WAVES;
+		ctx->errCode = ERR_NO_WAVES;
 		return false;
 	}
 
-	song.Revision = p[3];
+	song->Revision = p[3];
 
-	if (memcmp("THX", p, 3) != 0 || song.Revision > 1) // 8bb: added revision check
+	if (memcmp("THX", p, 3) != 0 || song->Revision > 1) // 8bb: added revision check
 	{
-		ahxErrCode = ERR_NOT_AN_AHX;
+		ctx->errCode = ERR_NOT_AN_AHX;
 		return false;
 	}
 
@@ -293,60 +199,60 @@ static bool ahxInitModule(const uint8_t *p)
 
 	READ_WORD(flags, p);
 	trkNullEmpty = !!(flags & 32768);
-	song.LenNr = flags & 0x3FF;
-	READ_WORD(song.ResNr, p);
-	READ_BYTE(song.TrackLength, p);
-	READ_BYTE(song.highestTrack, p); // max track nr. like 0
-	READ_BYTE(song.numInstruments, p); // max instr nr. 0/1-63
-	READ_BYTE(song.Subsongs, p);
-	uint32_t numTracks = song.highestTrack + 1;
+	song->LenNr = flags & 0x3FF;
+	READ_WORD(song->ResNr, p);
+	READ_BYTE(song->TrackLength, p);
+	READ_BYTE(song->highestTrack, p); // max track nr. like 0
+	READ_BYTE(song->numInstruments, p); // max instr nr. 0/1-63
+	READ_BYTE(song->Subsongs, p);
+	uint32_t numTracks = song->highestTrack + 1;
 
-	if (song.ResNr >= song.LenNr) // 8bb: safety bug-fix...
-		song.ResNr = 0;
+	if (song->ResNr >= song->LenNr) // 8bb: safety bug-fix...
+		song->ResNr = 0;
 
 	// 8bb: read sub-song table
-	const int32_t subSongTableBytes = song.Subsongs << 1;
+	const int32_t subSongTableBytes = song->Subsongs << 1;
 
-	song.SubSongTable = (uint16_t *)malloc(subSongTableBytes);
-	if (song.SubSongTable == NULL)
+	song->SubSongTable = (uint16_t *)malloc(subSongTableBytes);
+	if (song->SubSongTable == NULL)
 	{
-		ahxFree();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+		ahxFreeCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
 		return false;
 	}
 
 	const uint16_t *ptr16 = (uint16_t *)p;
-	for (int32_t i = 0; i < song.Subsongs; i++)
-		song.SubSongTable[i] = SWAP16(ptr16[i]);
+	for (int32_t i = 0; i < song->Subsongs; i++)
+		song->SubSongTable[i] = SWAP16(ptr16[i]);
 	p += subSongTableBytes;
 
 
 	// 8bb: read position table
-	const int32_t posTableBytes = song.LenNr << 3;
+	const int32_t posTableBytes = song->LenNr << 3;
 
-	song.PosTable = (uint8_t *)malloc(posTableBytes);
-	if (song.PosTable == NULL)
+	song->PosTable = (uint8_t *)malloc(posTableBytes);
+	if (song->PosTable == NULL)
 	{
-		ahxFree();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+		ahxFreeCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
 		return false;
 	}
 
 	for (int32_t i = 0; i < posTableBytes; i++)
-		song.PosTable[i] = *p++;
+		song->PosTable[i] = *p++;
 
 
 	// 8bb: read track table
-	song.TrackTable = (uint8_t *)calloc(numTracks, 3*64);
-	if (song.TrackTable == NULL)
+	song->TrackTable = (uint8_t *)calloc(numTracks, 3*64);
+	if (song->TrackTable == NULL)
 	{
-		ahxFree();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+		ahxFreeCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
 		return false;
 	}
 
 	int32_t tracksToRead = numTracks;
-	uint8_t *dst8 = song.TrackTable;
+	uint8_t *dst8 = song->TrackTable;
 
 	if (trkNullEmpty)
 	{
@@ -356,7 +262,7 @@ static bool ahxInitModule(const uint8_t *p)
 	
 	if (tracksToRead > 0)
 	{
-		const int32_t trackBytes = song.TrackLength * 3;
+		const int32_t trackBytes = song->TrackLength * 3;
 		for (int32_t i = 0; i < tracksToRead; i++)
 		{
 			memcpy(&dst8[i * 3 * 64], p, trackBytes);
@@ -365,43 +271,43 @@ static bool ahxInitModule(const uint8_t *p)
 	}
 
 	// 8bb: read instruments
-	for (int32_t i = 0; i < song.numInstruments; i++)
+	for (int32_t i = 0; i < song->numInstruments; i++)
 	{
 		instrument_t *ins = (instrument_t *)p;
 
 		const int32_t instrBytes = 22 + (ins->perfLength << 2);
 
 		// 8bb: calloc is needed here, to clear all non-written perfList bytes!
-		song.Instruments[i] = (instrument_t *)calloc(1, sizeof (instrument_t));
-		if (song.Instruments[i] == NULL)
+		song->Instruments[i] = (instrument_t *)calloc(1, sizeof (instrument_t));
+		if (song->Instruments[i] == NULL)
 		{
-			ahxFree();
-			ahxErrCode = ERR_OUT_OF_MEMORY;
+			ahxFreeCtx(ctx);
+			ctx->errCode = ERR_OUT_OF_MEMORY;
 			return false;
 		}
 
-		memcpy(song.Instruments[i], p, instrBytes);
+		memcpy(song->Instruments[i], p, instrBytes);
 		p += instrBytes;
 	}
 
-	song.Name[255] = '\0';
+	song->Name[255] = '\0';
 	for (int32_t i = 0; i < 255; i++)
 	{
-		song.Name[i] = (char)p[i];
-		if (song.Name[i] == '\0')
+		song->Name[i] = (char)p[i];
+		if (song->Name[i] == '\0')
 			break;
 	}
 
 	// 8bb: remove filter commands on rev-0 songs, if present (AHX does this)
-	if (song.Revision == 0)
+	if (song->Revision == 0)
 	{
 		uint8_t *ptr8;
 
 		// 8bb: clear command 4 (override filter) parameter
-		ptr8 = song.TrackTable;
-		for (int32_t i = 0; i <= song.highestTrack; i++)
+		ptr8 = song->TrackTable;
+		for (int32_t i = 0; i <= song->highestTrack; i++)
 		{
-			for (int32_t j = 0; j < song.TrackLength; j++)
+			for (int32_t j = 0; j < song->TrackLength; j++)
 			{
 				const uint8_t fx = ptr8[1] & 0x0F;
 				if (fx == 4) // FX: OVERRIDE FILTER!
@@ -415,9 +321,9 @@ static bool ahxInitModule(const uint8_t *p)
 		}
 
 		// 8bb: clear command 0/4 parameter in instrument plists
-		for (int32_t i = 0; i < song.numInstruments; i++)
+		for (int32_t i = 0; i < song->numInstruments; i++)
 		{
-			instrument_t *ins = song.Instruments[i];
+			instrument_t *ins = song->Instruments[i];
 			if (ins == NULL)
 				continue;
 
@@ -437,16 +343,40 @@ static bool ahxInitModule(const uint8_t *p)
 		}
 	}
 
+	// decode the track rows and instruments for the replayer (see trackRow_t in replayer.h)
+	song->TrackRows = (trackRow_t *)malloc(numTracks * 64 * sizeof (trackRow_t));
+	if (song->TrackRows == NULL)
+	{
+		ahxFreeCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	decodeTrackRows(song->TrackRows, song->TrackTable, numTracks * 64);
+
+	for (int32_t i = 0; i < song->numInstruments; i++)
+	{
+		song->InstrumentData[i] = (instrumentData_t *)malloc(sizeof (instrumentData_t));
+		if (song->InstrumentData[i] == NULL)
+		{
+			ahxFreeCtx(ctx);
+			ctx->errCode = ERR_OUT_OF_MEMORY;
+			return false;
+		}
+
+		decodeInstrument(song->InstrumentData[i], song->Instruments[i]);
+	}
+
 	// 8bb: added this (BPM/tempo)
-	song.SongCIAPeriod = tabler[(flags >> 13) & 3];
+	song->SongCIAPeriod = tabler[(flags >> 13) & 3];
 
-	// 8bb: set up waveform pointers (Note: song.WaveformTab[2] gets initialized in the replayer!)
-	song.WaveformTab[0] = waves->triangle04;
-	song.WaveformTab[1] = waves->sawtooth04;
-	song.WaveformTab[3] = waves->whiteNoiseBig;
+	// 8bb: set up waveform pointers (Note: song->WaveformTab[2] gets initialized in the replayer!)
+	song->WaveformTab[0] = waves->triangle04;
+	song->WaveformTab[1] = waves->sawtooth04;
+	song->WaveformTab[3] = waves->whiteNoiseBig;
 
 	// 8bb: Added this. Set default values for EmptyInstrument (used for non-loaded instruments in replayer)
-	instrument_t *ins = &song.EmptyInstrument;
+	instrument_t *ins = &song->EmptyInstrument;
 	memset(ins, 0, sizeof (instrument_t));
 	ins->aFrames = 1;
 	ins->dFrames = 1;
@@ -461,30 +391,32 @@ static bool ahxInitModule(const uint8_t *p)
 	ins->filterSpeedWavelength = 4<<3; // fs 3 wl 04 !!
 	// ----------------------------------------------------
 
-	song.songLoaded = true;
+	decodeInstrument(&song->EmptyInstrumentData, ins);
+
+	song->songLoaded = true;
 	return true;
 }
 
-bool ahxLoadFromRAM(const uint8_t *data)
+bool ahxLoadFromRAMCtx(ahx_context_t *ctx, const uint8_t *data)
 {
-	ahxErrCode = ERR_SUCCESS;
-	if (!ahxInitModule(data))
+	ctx->errCode = ERR_SUCCESS;
+	if (!ahxInitModule(ctx, data))
 	{
-		ahxFree();
+		ahxFreeCtx(ctx);
 		return false;
 	}
 
 	return true;
 }
 
-bool ahxLoad(const char *filename)
+bool ahxLoadCtx(ahx_context_t *ctx, const char *filename)
 {
-	ahxErrCode = ERR_SUCCESS;
+	ctx->errCode = ERR_SUCCESS;
 
 	FILE *f = fopen(filename, "rb");
 	if (f == NULL)
 	{
-		ahxErrCode = ERR_FILE_IO;
+		ctx->errCode = ERR_FILE_IO;
 		return false;
 	}
 
@@ -496,7 +428,7 @@ bool ahxLoad(const char *filename)
 	if (fileBuffer == NULL)
 	{
 		fclose(f);
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+		ctx->errCode = ERR_OUT_OF_MEMORY;
 		return false;
 	}
 
@@ -504,13 +436,13 @@ bool ahxLoad(const char *filename)
 	{
 		free(fileBuffer);
 		fclose(f);
-		ahxErrCode = ERR_FILE_IO;
+		ctx->errCode = ERR_FILE_IO;
 		return false;
 	}
 
 	fclose(f);
 
-	if (!ahxLoadFromRAM((const uint8_t *)fileBuffer))
+	if (!ahxLoadFromRAMCtx(ctx, (const uint8_t *)fileBuffer))
 	{
 		free(fileBuffer);
 		return false;
@@ -520,25 +452,48 @@ bool ahxLoad(const char *filename)
 	return true;
 }
 
-void ahxFree(void)
+void ahxFreeCtx(ahx_context_t *ctx)
 {
-	ahxStop();
-	paulaStopAllDMAs(); // 8bb: song can be free'd now
+	song_t *song = &ctx->song;
 
-	if (song.SubSongTable != NULL)
-		free(song.SubSongTable);
+	ahxStopCtx(ctx);
+	paulaStopAllDMAs(&ctx->paula); // 8bb: song can be free'd now
 
-	if (song.PosTable != NULL)
-		free(song.PosTable);
+	if (song->SubSongTable != NULL)
+		free(song->SubSongTable);
 
-	if (song.TrackTable != NULL)
-		free(song.TrackTable);
+	if (song->PosTable != NULL)
+		free(song->PosTable);
 
-	for (int32_t i = 0; i < song.numInstruments; i++)
+	if (song->TrackTable != NULL)
+		free(song->TrackTable);
+
+	if (song->TrackRows != NULL)
+		free(song->TrackRows);
+
+	for (int32_t i = 0; i < song->numInstruments; i++)
 	{
-		if (song.Instruments[i] != NULL)
-			free(song.Instruments[i]);
+		if (song->Instruments[i] != NULL)
+			free(song->Instruments[i]);
+
+		if (song->InstrumentData[i] != NULL)
+			free(song->InstrumentData[i]);
 	}
 
-	memset(&song, 0, sizeof (song));
+	memset(song, 0, sizeof (song_t));
+}
+
+bool ahxLoadFromRAM(const uint8_t *data)
+{
+	return ahxLoadFromRAMCtx(&ahxDefaultContext, data);
+}
+
+bool ahxLoad(const char *filename)
+{
+	return ahxLoadCtx(&ahxDefaultContext, filename);
+}
+
+void ahxFree(void)
+{
+	ahxFreeCtx(&ahxDefaultContext);
 }
@@ -21,11 +21,43 @@
 
 #define AMIGA_VOICES 4
 
+// output rate limits. Below ~31.4kHz (PAULA_PAL_CLK / 113), voices can fetch several sample points per output sample
+#define PAULA_MIN_FREQ 8000
+#define PAULA_MAX_FREQ 384000
+
+/*
+** BLEP synthesis (coded by aciddose), see paula.c for information on these.
+*/
+#define BLEP_ZC 16
+#define BLEP_OS 16
+#define BLEP_SP 16
+#define BLEP_NS (BLEP_ZC * BLEP_OS / BLEP_SP)
+#define BLEP_RNS 31 // RNS = (2^ > NS) - 1
+#define BLEP_PHASES 1024 // sub-sample positions in the optional polyphase BLEP table (see paula.c)
+#define BLEP_SHORT_NS 8 // taps in the short BLEP table (PAULA_QUALITY_SHORT_BLEP)
+
+typedef struct ahx_context_t ahx_context_t; // opaque player context (see replayer.h)
+
+enum // mixer engines, see paulaSetEngine()
+{
+	PAULA_ENGINE_DOUBLE = 0, // reference
+	PAULA_ENGINE_FLOAT  = 1, // single-precision, for FPUs/SIMD units where that's a lot faster
+	PAULA_ENGINE_FIXED  = 2  // integer only, for targets without (or with a slow) FPU
+};
+
+enum // mixer quality, see paulaInit()
+{
+	PAULA_QUALITY_BLEP       = 0, // full BLEP synthesis (reference)
+	PAULA_QUALITY_SHORT_BLEP = 1, // half-length BLEPs, a bit more aliasing
+	PAULA_QUALITY_ZOH        = 2  // no BLEP synthesis (zero-order hold), aliases a lot, cheapest
+};
+
 typedef struct audio_t
 {
 	volatile bool playing, pause;
 	int32_t outputFreq, masterVol, stereoSeparation;
 	int64_t tickSampleCounter64, samplesPerTick64;
+	uint32_t lookaheadUnderruns; // ticks that were due before the replayer thread had made them (see paulaSetLookahead())
 } audio_t;
 
 typedef struct voice_t
@@ -37,7 +69,6 @@ typedef struct voice_t
 	const int8_t *location; // current location
 	uint16_t lengthCounter; // current length
 	int32_t sampleCounter; // how many bytes left in AUD_DAT
-	double dSample; // current sample point
 
 	// registers modified by Paula functions
 	const int8_t *AUD_LC; // location
@@ -45,38 +76,232 @@ typedef struct voice_t
 	double AUD_PER_delta; // delta
 	double AUD_VOL; // volume
 
-	double dDelta, dPhase;
-
 	// for BLEP synthesis
-	double dLastDelta, dLastPhase, dBlepOffset, dDeltaMul;
+	double dDeltaMul;
+
+	float fVol; // for the single-precision engine
+
+	// for the fixed-point engine
+	int32_t volume; // 0..64
+	uint64_t AUD_PER_delta64, oldVoiceDelta64; // 16.48fp
 
 	// period cache
 	int32_t oldPeriod;
 	double dOldVoiceDelta, dOldVoiceDeltaMul;
 } paulaVoice_t;
 
-void paulaClearFilterState(void);
-void resetCachedMixerPeriod(void);
-void resetAudioDithering(void);
+/* The state the mixer touches on every output sample, in structure-of-arrays
+** layout (one lane per voice) so that all four voices can be mixed in SIMD lanes.
+**
+** All voices share one BLEP ring buffer index. This works because a voice's
+** ring is always fully zeroed by the time its samplesLeft counter runs out,
+** so it doesn't matter if the index keeps advancing while nothing is in flight.
+*/
+typedef struct paulaLanes_t
+{
+	double dPhase[AMIGA_VOICES], dDelta[AMIGA_VOICES];
+	double dSample[AMIGA_VOICES]; // current sample point
+
+	// for BLEP synthesis
+	double dLastDelta[AMIGA_VOICES], dLastPhase[AMIGA_VOICES], dBlepOffset[AMIGA_VOICES];
+	double dBlepLastValue[AMIGA_VOICES];
+	double dBlepBuffer[BLEP_RNS+1][AMIGA_VOICES]; // interleaved, one row per output sample
+	int32_t blepIndex, blepSamplesLeft[AMIGA_VOICES];
+	const double *dBlepPhases; // polyphase BLEP taps, or NULL to interpolate the minBLEP table
+} paulaLanes_t;
+
+/* The sample and BLEP part of paulaLanes_t for the single-precision engine.
+** The phase stays in paulaLanes_t (double), so that sample fetches happen at the
+** same output samples in both engines. The BLEP ring index is shared too.
+*/
+typedef struct paulaLanesF_t
+{
+	float fSample[AMIGA_VOICES];
+	float fBlepLastValue[AMIGA_VOICES];
+	float fBlepBuffer[BLEP_RNS+1][AMIGA_VOICES];
+	int32_t blepSamplesLeft[AMIGA_VOICES];
+} paulaLanesF_t;
+
+// paulaLanes_t for the fixed-point engine, sample points are 8.24fp (1.0 = 1 << 24)
+typedef struct paulaLanesFixed_t
+{
+	uint64_t phase64[AMIGA_VOICES], delta64[AMIGA_VOICES]; // 16.48fp
+	int32_t sample[AMIGA_VOICES];
+
+	uint64_t lastDelta64[AMIGA_VOICES], lastPhase64[AMIGA_VOICES];
+	int32_t blepLastValue[AMIGA_VOICES];
+	int32_t blepBuffer[BLEP_RNS+1][AMIGA_VOICES];
+	int32_t blepSamplesLeft[AMIGA_VOICES];
+} paulaLanesFixed_t;
+
+typedef struct rcFilter_t
+{
+	double tmp[2], c1, c2;
+} rcFilter_t;
+
+typedef struct rcFilterF_t
+{
+	float tmp[2], c1, c2;
+} rcFilterF_t;
+
+typedef struct rcFilterFixed_t
+{
+	int64_t tmp[2]; // 24.40fp
+	int32_t c1; // 8.24fp
+} rcFilterFixed_t;
+
+/* The Paula writes of one replayer tick, for the lookahead mode (see paulaSetLookahead()).
+** The voice buffer contents are copied in (or the voice is pointed at an image of them)
+** when the mixer gets to the tick, not when the replayer makes it, as Paula can be
+** anywhere in the buffer at that point.
+*/
+#define PAULA_VOICE_BUFFER_SIZE 0x280 /* bytes, AHX's fixed voice buffer size */
+
+enum
+{
+	PAULA_WRITE_PERIOD = 1,
+	PAULA_WRITE_VOLUME = 2,
+	PAULA_WRITE_DATA   = 4  // copy data[ch] to dataTarget[ch], or if that's NULL, point the voice at dataImage[ch]
+};
+
+typedef struct paulaTickWrites_t
+{
+	uint8_t flags[AMIGA_VOICES]; // PAULA_WRITE_xxx
+	uint16_t period[AMIGA_VOICES], volume[AMIGA_VOICES];
+	int8_t *dataTarget[AMIGA_VOICES];
+	const int8_t *dataImage[AMIGA_VOICES]; // see paulaSetDataImage()
+	int8_t data[AMIGA_VOICES][PAULA_VOICE_BUFFER_SIZE];
+} paulaTickWrites_t;
+
+typedef struct paula_t // all Paula/mixer state, one per player context
+{
+	audio_t audio;
+	paulaVoice_t voice[AMIGA_VOICES];
+	paulaLanes_t lanes;
+	void (*mixChannels)(struct paula_t *p, int32_t numSamples); // picked from the CPU features in paulaInit()
+	void (*postMix)(struct paula_t *p, int16_t *target, int32_t numSamples); // ditto
+	rcFilter_t filterHiA1200;
+	bool usesAudioDevice; // only lock the audio driver if this state is what it's mixing
+	int32_t randSeed;
+	double *dFetchBuffer; // sample points read ahead by the SIMD mixer
+	double *dBlepPhaseBuffer, *dBlepPhaseTable; // polyphase BLEP taps (allocated when first enabled, and 64-byte aligned)
+	bool usePolyphaseBLEP;
+	bool channelBLEP; // BLEPs are summed per output channel, straight into the mix buffers
+	int32_t quality; // PAULA_QUALITY_xxx, set in paulaInit()
+	double dBlepShortTable[BLEP_SHORT_NS*BLEP_SP+1]; // short BLEP table (+1 padding for interpolation)
+	double *dMixBufferL, *dMixBufferR, dPrngStateL, dPrngStateR, dSideFactor, dPeriodToDeltaDiv, dMixNormalize;
+
+	// single-precision engine
+	int32_t engine;
+	paulaLanesF_t lanesF;
+	rcFilterF_t filterHiA1200F;
+	float fBlepTable[BLEP_ZC*BLEP_OS+1]; // minBLEP table (+1 padding for interpolation)
+	float fBlepShortTable[BLEP_SHORT_NS*BLEP_SP+1];
+	float *fMixBufferL, *fMixBufferR, fPrngStateL, fPrngStateR, fSideFactor, fMixNormalize;
+
+	// fixed-point engine
+	paulaLanesFixed_t lanesFixed;
+	rcFilterFixed_t filterHiA1200Fixed;
+	int32_t blepTableFixed[BLEP_ZC*BLEP_OS+1]; // minBLEP table in 2.30fp (+1 padding for interpolation)
+	int32_t blepShortTableFixed[BLEP_SHORT_NS*BLEP_SP+1];
+	int32_t *mixBufferL, *mixBufferR, prngStateL, prngStateR; // mix buffers in 8.24fp, dither in 16.16fp
+	int32_t sideFactor, mixNormalize; // 16.16fp
+	uint64_t periodToDeltaDiv64; // 16.48fp
+
+	// lookahead mode, a queue of replayer ticks made by another thread (see paulaSetLookahead())
+	paulaTickWrites_t *tickQueue;
+	uint32_t tickQueueSize;
+	volatile uint32_t tickQueueHead, tickQueueTail; // written by the replayer thread and the mixer, respectively
+	volatile int32_t replayerLock; // held by the replayer thread while it makes a tick, and by paulaLockMixer()
+	int32_t lockDepth;
+} paula_t;
+
+/* The Paula/mixer state that continues from one output sample to the next (see
+** ahxSaveState() in replayer.h). The voices' sample pointers are stored as offsets
+** into the sample memory given to paulaSaveState(), or into Paula's own empty sample
+** (if PAULA_STATE_EMPTY_SAMPLE is set). The mixer settings are not part of it.
+*/
+#define PAULA_STATE_EMPTY_SAMPLE 0x80000000
+
+typedef struct paulaState_t
+{
+	int64_t tickSampleCounter64, samplesPerTick64;
+	paulaVoice_t voice[AMIGA_VOICES]; // location and AUD_LC are NULL, see below
+	uint32_t locationOffset[AMIGA_VOICES], AUD_LCOffset[AMIGA_VOICES];
+	paulaLanes_t lanes; // dBlepPhases is NULL (it's a setting)
+	paulaLanesF_t lanesF;
+	paulaLanesFixed_t lanesFixed;
+	double dFilterTmp[2], dPrngStateL, dPrngStateR;
+	float fFilterTmp[2], fPrngStateL, fPrngStateR;
+	int64_t filterTmpFixed[2];
+	int32_t prngStateL, prngStateR, randSeed;
+	double dMixCarryL[BLEP_NS], dMixCarryR[BLEP_NS]; // BLEPs running past the last mixed block (if channel BLEPs are on)
+	float fMixCarryL[BLEP_NS], fMixCarryR[BLEP_NS];
+	int32_t mixCarryL[BLEP_NS], mixCarryR[BLEP_NS];
+	int32_t engine;
+	bool channelBLEP;
+} paulaState_t;
+
+/* These operate on the player state of one context, and are
+** used by the replayer. The lock/unlock pair only touches the
+** audio driver if the state is the one the driver is mixing.
+*/
+void paulaLockMixer(paula_t *p);
+void paulaUnlockMixer(paula_t *p);
+
+void paulaClearFilterState(paula_t *p);
+void resetCachedMixerPeriod(paula_t *p);
+void resetAudioDithering(paula_t *p);
 
 double amigaCIAPeriod2Hz(uint16_t period);
-bool amigaSetCIAPeriod(uint16_t period); // replayer ticker speed
+int64_t amigaCIAPeriod2SamplesPerTick64(uint16_t period, int32_t audioFrequency); // 32.32fp
+bool amigaSetCIAPeriod(paula_t *p, uint16_t period); // replayer ticker speed
 
-void paulaMixSamples(int16_t *target, int32_t numSamples);
-bool paulaInit(int32_t audioFrequency);
-void paulaClose(void);
+bool paulaInit(paula_t *p, int32_t audioFrequency, int32_t quality); // quality = PAULA_QUALITY_xxx
+void paulaClose(paula_t *p);
+
+// only call these while the mixer is locked. paulaLoadState() returns false if an offset is out of range
+void paulaSaveState(const paula_t *p, const int8_t *sampleData, paulaState_t *s);
+bool paulaLoadState(paula_t *p, const int8_t *sampleData, uint32_t sampleDataSize, const paulaState_t *s);
+void paulaSkipSamples(paula_t *p, int32_t numSamples); // advances the voices without mixing (see paula.c)
+
+void paulaStopAllDMAs(paula_t *p);
+void paulaStartAllDMAs(paula_t *p);
+void paulaSetPeriod(paula_t *p, int32_t ch, uint16_t period);
+void paulaSetVolume(paula_t *p, int32_t ch, uint16_t vol);
+void paulaSetLength(paula_t *p, int32_t ch, uint16_t len);
+void paulaSetData(paula_t *p, int32_t ch, const int8_t *src);
+void paulaSetDataImage(paula_t *p, int32_t ch, const int8_t *src); // like copying src over the voice's data (see paula.c)
 
+/* Lookahead mode. With numTicks > 0, the mixer doesn't run the replayer itself, it applies
+** the Paula writes of ticks that another thread made in advance (see ahxRunLookahead() in
+** replayer.h). paulaBeginTickWrites() returns NULL if the queue is full, or if the mixer is
+** locked. Otherwise the tick has to be finished with paulaEndTickWrites().
+** paulaDiscardTickWrites() drops the queued ticks, only call it while the mixer is locked.
+*/
+bool paulaSetLookahead(paula_t *p, int32_t numTicks); // 0 = off (default)
+paulaTickWrites_t *paulaBeginTickWrites(paula_t *p);
+void paulaEndTickWrites(paula_t *p);
+void paulaDiscardTickWrites(paula_t *p);
+
+// context versions, safe to use on many contexts from many threads at once
+void paulaMixSamplesCtx(ahx_context_t *ctx, int16_t *target, int32_t numSamples);
+void paulaOutputSamplesCtx(ahx_context_t *ctx, int16_t *stream, int32_t numSamples);
+void paulaSetMasterVolumeCtx(ahx_context_t *ctx, int32_t vol);
+void paulaSetStereoSeparationCtx(ahx_context_t *ctx, int32_t percentage); // 0..100 (percentage)
+bool paulaSetPolyphaseBLEPCtx(ahx_context_t *ctx, bool enable); // faster, but not exact (default = off), false if out of memory
+void paulaSetChannelBLEPCtx(ahx_context_t *ctx, bool enable); // faster, exact within double rounding (default = off)
+bool paulaSetEngineCtx(ahx_context_t *ctx, int32_t engine); // PAULA_ENGINE_xxx (default = PAULA_ENGINE_DOUBLE), false if out of memory
+void paulaTogglePauseCtx(ahx_context_t *ctx);
+const audio_t *paulaGetAudioCtx(ahx_context_t *ctx);
+
+// these operate on the default context (the one ahxInit() connects to the audio driver)
+void paulaMixSamples(int16_t *target, int32_t numSamples);
+void paulaOutputSamples(int16_t *stream, int32_t numSamples);
 void paulaSetMasterVolume(int32_t vol);
 void paulaSetStereoSeparation(int32_t percentage); // 0..100 (percentage)
-
+bool paulaSetPolyphaseBLEP(bool enable); // faster, but not exact (default = off), false if out of memory
+void paulaSetChannelBLEP(bool enable); // faster, exact within double rounding (default = off)
+bool paulaSetEngine(int32_t engine); // PAULA_ENGINE_xxx (default = PAULA_ENGINE_DOUBLE), false if out of memory
 void paulaTogglePause(void);
-void paulaOutputSamples(int16_t *stream, int32_t numSamples);
-void paulaStopAllDMAs(void);
-void paulaStartAllDMAs(void);
-void paulaSetPeriod(int32_t ch, uint16_t period);
-void paulaSetVolume(int32_t ch, uint16_t vol);
-void paulaSetLength(int32_t ch, uint16_t len);
-void paulaSetData(int32_t ch, const int8_t *src);
-
-extern audio_t audio; // paula.c
-extern paulaVoice_t paula[AMIGA_VOICES]; // paula.c
+const audio_t *paulaGetAudio(void);
@@ -11,9 +11,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h> // offsetof()
 #include <string.h>
 #include <math.h> // ceil()
 #include "replayer.h"
+#include "ahxcontext.h"
 
 static const uint8_t waveOffsets[6] =
 {
@@ -64,36 +66,27 @@ static const int16_t vibTable[64] =
 	-180,-161,-141,-120, -97, -74, -49, -24
 };
 
-// 8bb: globalized
-volatile bool isRecordingToWAV;
-song_t song;
-waveforms_t *waves; // 8bb: dword-aligned from malloc()
-uint8_t ahxErrCode;
-// ------------
+ahx_context_t ahxDefaultContext; // used by the context-less API
 
-// 8bb: loader.c
-bool ahxInitWaves(void);
-void ahxFreeWaves(void);
-// -----------
-
-static void SetUpAudioChannels(void) // 8bb: only call this while mixer is locked!
+static void SetUpAudioChannels(ahx_context_t *ctx) // 8bb: only call this while mixer is locked!
 {
 	plyVoiceTemp_t *ch;
+	paula_t *p = &ctx->paula;
 
-	paulaStopAllDMAs();
+	paulaStopAllDMAs(p);
 
-	ch = song.pvt;
+	ch = ctx->song.pvt;
 	for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
 	{
-		ch->audioPointer = waves->currentVoice[i];
+		ch->audioPointer = ctx->buffers->currentVoice[i];
 
-		paulaSetPeriod(i, 0x88);
-		paulaSetData(i, ch->audioPointer);
-		paulaSetVolume(i, 0);
-		paulaSetLength(i, 0x280 / 2);
+		paulaSetPeriod(p, i, 0x88);
+		paulaSetData(p, i, ch->audioPointer);
+		paulaSetVolume(p, i, 0);
+		paulaSetLength(p, i, 0x280 / 2);
 	}
 
-	paulaStartAllDMAs();
+	paulaStartAllDMAs(p);
 }
 
 static void InitVoiceXTemp(plyVoiceTemp_t *ch) // 8bb: only call this while mixer is locked!
@@ -110,18 +103,22 @@ static void InitVoiceXTemp(plyVoiceTemp_t *ch) // 8bb: only call this while mixe
 	ch->audioPointer = oldAudioPointer;
 }
 
-static void ahxQuietAudios(void)
+static void ahxQuietAudios(ahx_context_t *ctx)
 {
 	for (int32_t i = 0; i < AMIGA_VOICES; i++)
-		paulaSetVolume(i, 0);
+		paulaSetVolume(&ctx->paula, i, 0);
 }
 
-static void CopyWaveformToPaulaBuffer(plyVoiceTemp_t *ch) // 8bb: I put this code in an own function
+static void CopyWaveformToPaulaBuffer(plyVoiceTemp_t *ch, int8_t *dst) // 8bb: I put this code in an own function
 {
 	// 8bb: audioPointer and audioSource buffers are dword-aligned, 32-bit access is safe
-	uint32_t *dst32 = (uint32_t *)ch->audioPointer;
+	uint32_t *dst32 = (uint32_t *)dst;
 
-	if (ch->Waveform == 4-1) // 8bb: noise, copy in one go
+	if (ch->Waveform == 3-1 && ch->audioSource != ch->SquareTempBuffer) // a square image, already repeated (see getSquareImage())
+	{
+		memcpy(dst, ch->audioSource, 0x280);
+	}
+	else if (ch->Waveform == 4-1) // 8bb: noise, copy in one go
 	{
 		const uint32_t *src32 = (const uint32_t *)ch->audioSource;
 		for (int32_t i = 0; i < 0x280/8; i++)
@@ -144,33 +141,133 @@ static void CopyWaveformToPaulaBuffer(plyVoiceTemp_t *ch) // 8bb: I put this cod
 	}
 }
 
-static void SetAudio(int32_t chNum, plyVoiceTemp_t *ch)
+/* Waveform images: one cycle of a waveform, repeated over a whole voice buffer like
+** CopyWaveformToPaulaBuffer() does it. They're made the first time they're needed and
+** never changed after that. The cycle is sampled from src8 at every delta'th byte.
+** NULL if out of memory.
+*/
+static const int8_t *getImage(int8_t ***images, int32_t numImages, int32_t index, const int8_t *src8, int32_t delta, int32_t wavelength)
+{
+	if (*images == NULL)
+	{
+		*images = (int8_t **)calloc(numImages, sizeof (int8_t *));
+		if (*images == NULL)
+			return NULL;
+	}
+
+	int8_t **image = &(*images)[index];
+	if (*image == NULL)
+	{
+		int8_t *dst8 = (int8_t *)malloc(0x280); // dword-aligned, like the waves
+		if (dst8 == NULL)
+			return NULL;
+
+		const int32_t cycles = (1 << wavelength) << 2;
+
+		for (int32_t i = 0; i < cycles; i++)
+			dst8[i] = src8[i * delta];
+
+		for (int32_t i = cycles; i < 0x280; i += cycles)
+			memcpy(&dst8[i], dst8, cycles);
+
+		*image = dst8;
+	}
+
+	return *image;
+}
+
+/* The voice buffer contents of ch's new waveform as an image that never changes, so that
+** Paula can play it where it is instead of it being copied to the voice buffer (see
+** SetAudio()). Noise is 0x280 bytes in the tables already, cached squares are images
+** already (see getSquareImage()), and triangles and sawtooths are cached as images.
+** NULL if there's none (or the waveforms are copied, see ahxSetWaveformCopyingCtx()).
+*/
+static const int8_t *getWaveImage(ahx_context_t *ctx, const plyVoiceTemp_t *ch)
+{
+	if (ctx->copyWaveforms)
+		return NULL;
+
+	if (ch->Waveform == 4-1)
+		return ch->audioSource;
+
+	if (ch->Waveform == 3-1)
+		return (ch->audioSource != ch->SquareTempBuffer) ? ch->audioSource : NULL;
+
+	const int32_t filterPos = (ch->filterPos == 0 || ch->filterPos > 63) ? 0 : ch->filterPos; // 0 = EmptyFilterSection
+	const int32_t index = (((filterPos << 1) + ch->Waveform) * 6) + ch->Wavelength;
+
+	return getImage(&ctx->waveImages, WAVE_IMAGES, index, ch->audioSource, 1, ch->Wavelength);
+}
+
+static void SetAudio(ahx_context_t *ctx, int32_t chNum, plyVoiceTemp_t *ch)
 {
 	// new PERIOD to plant ???
 	if (ch->PlantPeriod)
 	{
-		paulaSetPeriod(chNum, ch->audioPeriod);
+		paulaSetPeriod(&ctx->paula, chNum, ch->audioPeriod);
 		ch->PlantPeriod = false;
 	}
 
 	// new FILTER or new WAVEFORM ???
 	if (ch->NewWaveform)
 	{
-		CopyWaveformToPaulaBuffer(ch);
+		/* Paula is pointed at the waveform's image (at the same position, see paulaSetDataImage()),
+		** which is the same as copying it over the voice buffer mid-DMA. Without one, it's
+		** copied, and Paula is pointed back at the voice buffer if it was playing an image.
+		*/
+		const int8_t *image = getWaveImage(ctx, ch);
+		if (image == NULL)
+		{
+			CopyWaveformToPaulaBuffer(ch, ch->audioPointer);
+			image = ch->audioPointer;
+		}
+
+		paulaSetDataImage(&ctx->paula, chNum, image);
+		ch->NewWaveform = false;
+	}
+
+	paulaSetVolume(&ctx->paula, chNum, ch->audioVolume);
+}
+
+// SetAudio() for the lookahead mode, the writes are queued for the mixer (see ahxRunLookahead())
+static void QueueAudio(ahx_context_t *ctx, paulaTickWrites_t *w, int32_t chNum, plyVoiceTemp_t *ch)
+{
+	w->flags[chNum] = PAULA_WRITE_VOLUME;
+
+	if (ch->PlantPeriod)
+	{
+		w->flags[chNum] |= PAULA_WRITE_PERIOD;
+		w->period[chNum] = ch->audioPeriod;
+		ch->PlantPeriod = false;
+	}
+
+	if (ch->NewWaveform)
+	{
+		w->flags[chNum] |= PAULA_WRITE_DATA;
+		w->dataImage[chNum] = getWaveImage(ctx, ch);
+		w->dataTarget[chNum] = NULL;
+
+		if (w->dataImage[chNum] == NULL)
+		{
+			w->dataTarget[chNum] = ch->audioPointer;
+			CopyWaveformToPaulaBuffer(ch, w->data[chNum]);
+		}
+
 		ch->NewWaveform = false;
 	}
 
-	paulaSetVolume(chNum, ch->audioVolume);
+	w->volume[chNum] = ch->audioVolume;
 }
 
-static void ProcessStep(plyVoiceTemp_t *ch)
+static void ProcessStep(ahx_context_t *ctx, plyVoiceTemp_t *ch)
 {
 	uint8_t note, instr, cmd, param;
+	song_t *song = &ctx->song;
 
 	ch->volumeSlideUp = 0; // means A cmd
 	ch->volumeSlideDown = 0; // means A cmd
 
-	if (ch->Track > song.highestTrack) // 8bb: added this (this is technically what happens in AHX on illegal tracks)
+	if (ch->Track > song->highestTrack) // 8bb: added this (this is technically what happens in AHX on illegal tracks)
 	{
 		note = 0;
 		instr = 0;
@@ -179,12 +276,12 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 	}
 	else
 	{
-		const uint8_t *bytes = &song.TrackTable[((ch->Track << 6) + song.NoteNr) * 3];
+		const trackRow_t *row = &song->TrackRows[(ch->Track << 6) + song->NoteNr];
 
-		note = (bytes[0] >> 2) & 0x3F;
-		instr = ((bytes[0] & 3) << 4) | (bytes[1] >> 4);
-		cmd = bytes[1] & 0xF;
-		param = bytes[2];
+		note = row->note;
+		instr = row->instr;
+		cmd = row->cmd;
+		param = row->param;
 	}
 
 	// Effect  > E <  -  Enhanced Commands
@@ -195,7 +292,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 
 		if (eCmd == 0xC) // Effect  > EC<  -  NoteCut
 		{
-			if (eParam < song.Tempo)
+			if (eParam < song->Tempo)
 			{
 				ch->NoteCutWait = eParam;
 				ch->NoteCutOn = true;
@@ -209,7 +306,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 			{
 				ch->NoteDelayOn = false;
 			}
-			else if (eParam < song.Tempo)
+			else if (eParam < song->Tempo)
 			{
 				ch->NoteDelayWait = eParam;
 				if (ch->NoteDelayWait != 0)
@@ -227,7 +324,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 		{
 			uint8_t pos = param & 0xF;
 			if (pos <= 9)
-				song.PosJump = (param & 0xF) << 8; // 8bb: yes, this clears the lower byte too!
+				song->PosJump = (param & 0xF) << 8; // 8bb: yes, this clears the lower byte too!
 		}
 	}
 
@@ -235,28 +332,28 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 
 	if (cmd == 0xD) // Effect  > D <  -  Patternbreak
 	{
-		song.PosJump = song.PosNr + 1; // jump to next position (8bb: yes, it clears PosJump hi-byte)
+		song->PosJump = song->PosNr + 1; // jump to next position (8bb: yes, it clears PosJump hi-byte)
 
-		song.PosJumpNote = ((param >> 4) * 10) + (param & 0xF);
-		if (song.PosJumpNote >= song.TrackLength)
-			song.PosJumpNote = 0;
+		song->PosJumpNote = ((param >> 4) * 10) + (param & 0xF);
+		if (song->PosJumpNote >= song->TrackLength)
+			song->PosJumpNote = 0;
 
-		song.PatternBreak = true;
+		song->PatternBreak = true;
 	}
 
 	if (cmd == 0xB) // Effect  > B <  -  Positionjump
 	{
-		song.PosJump = (song.PosJump * 100) + ((param >> 4) * 10) + (param & 0xF);
-		song.PatternBreak = true;
+		song->PosJump = (song->PosJump * 100) + ((param >> 4) * 10) + (param & 0xF);
+		song->PatternBreak = true;
 	}
 
 	if (cmd == 0xF) // Effect  > F <  -  Set Tempo
 	{
-		song.Tempo = param;
+		song->Tempo = param;
 
 		// 8bb: added this for the WAV renderer
-		if (song.Tempo == 0)
-			isRecordingToWAV = false;
+		if (song->Tempo == 0)
+			ctx->isRecordingToWAV = false;
 	}
 
 	// Effect  > 5 <  -  Volume Slide + Tone Portamento
@@ -270,8 +367,6 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 	// Instrument to initialize ?
 	if (instr > 0)
 	{
-		int16_t delta;
-
 		ch->perfSubVolume = 64;
 
 		// reset portamento
@@ -280,91 +375,52 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 		ch->periodSlideLimit = 0;
 
 		// init adsr-envelope
-		instrument_t *ins = song.Instruments[instr-1];
+		instrument_t *ins = song->Instruments[instr-1];
+		const instrumentData_t *data = song->InstrumentData[instr-1];
 		if (ins == NULL) // 8bb: added this (this is technically what happens in AHX on illegal instruments)
-			ins = &song.EmptyInstrument;
+		{
+			ins = &song->EmptyInstrument;
+			data = &song->EmptyInstrumentData;
+		}
 
 		ch->adsr = 0; // adsr starting at vol. 0!
 
+		// 8.8fp deltas, divided out at load time (see decodeInstrument() in loader.c)
 		ch->aFrames = ins->aFrames;
-		delta = ins->aVolume << 8;
-		if (ch->aFrames != 0)
-			delta /= ch->aFrames;
-		ch->aDelta = delta;
-
+		ch->aDelta = data->aDelta;
 		ch->dFrames = ins->dFrames;
-		delta = ((int8_t)ins->dVolume - (int8_t)ins->aVolume) << 8;
-		if (ch->dFrames != 0)
-			delta /= ch->dFrames;
-		ch->dDelta = delta;
-
+		ch->dDelta = data->dDelta;
 		ch->sFrames = ins->sFrames;
-
 		ch->rFrames = ins->rFrames;
-		delta = ((int8_t)ins->rVolume - (int8_t)ins->dVolume) << 8;
-		if (ch->rFrames != 0)
-			delta /= ch->rFrames;
-		ch->rDelta = delta;
+		ch->rDelta = data->rDelta;
 
 		// copy Instrument values
-		ch->Wavelength = ins->filterSpeedWavelength & 0b00000111;
-
-		if (ch->Wavelength > 5) // 8bb: safety bug-fix...
-			ch->Wavelength = 5;
+		ch->Wavelength = data->Wavelength;
 
 		ch->NoteMaxVolume = ins->Volume;
 
 		ch->vibratoCurrent = 0;
 		ch->vibratoDelay = ins->vibratoDelay;
-		ch->vibratoDepth = ins->vibratoDepth & 0b00001111;
+		ch->vibratoDepth = data->vibratoDepth;
 		ch->vibratoSpeed = ins->vibratoSpeed;
 		ch->VibratoPeriod = 0;
-		ch->HardCutRelease = !!(ins->vibratoDepth & 128);
-		ch->HardCut = (ins->vibratoDepth & 0b01110000) >> 4;
+		ch->HardCutRelease = data->HardCutRelease;
+		ch->HardCut = data->HardCut;
 
 		ch->IgnoreSquare = false; // don't ignore the 3xx...
 		ch->squareSlidingIn = false;
 		ch->squareWait = 0;
 		ch->squareOn = false;
-
-		uint8_t lowerLimit = ins->squareLowerLimit >> (5 - ch->Wavelength);
-		uint8_t upperLimit = ins->squareUpperLimit >> (5 - ch->Wavelength);
-
-		if (lowerLimit <= upperLimit)
-		{
-			ch->squareLowerLimit = lowerLimit;
-			ch->squareUpperLimit = upperLimit;
-		}
-		else
-		{
-			ch->squareLowerLimit = upperLimit;
-			ch->squareUpperLimit = lowerLimit;
-		}
+		ch->squareLowerLimit = data->squareLowerLimit;
+		ch->squareUpperLimit = data->squareUpperLimit;
 
 		ch->IgnoreFilter = 0;
 		ch->filterWait = 0;
 		ch->filterOn = false;
 		ch->filterSlidingIn = false;
-
-		ch->filterSpeed = ins->filterSpeedWavelength >> 3; // shift out wavelength!
-
-		lowerLimit = ins->filterLowerLimit;
-		upperLimit = ins->filterUpperLimit;
-		if (lowerLimit & 128) ch->filterSpeed |= 32;
-		if (upperLimit & 128) ch->filterSpeed |= 64;
-		lowerLimit &= ~128;
-		upperLimit &= ~128;
-
-		if (lowerLimit <= upperLimit)
-		{
-			ch->filterLowerLimit = lowerLimit;
-			ch->filterUpperLimit = upperLimit;
-		}
-		else
-		{
-			ch->filterLowerLimit = upperLimit;
-			ch->filterUpperLimit = lowerLimit;
-		}
+		ch->filterSpeed = data->filterSpeed;
+		ch->filterLowerLimit = data->filterLowerLimit;
+		ch->filterUpperLimit = data->filterUpperLimit;
 
 		ch->filterPos = 32; // std: no filter!
 		ch->perfWait = 0;
@@ -372,6 +428,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 		ch->perfCurrent = 0;
 
 		ch->Instrument = ins;
+		ch->InstrumentData = data;
 		ch->perfList = ins->perfList;
 	}
 
@@ -489,7 +546,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 				if (p <= 0x40)
 				{
 					// 8bb: set TrackMasterVolume for all channels
-					plyVoiceTemp_t *c = song.pvt;
+					plyVoiceTemp_t *c = song->pvt;
 					for (int32_t i = 0; i < AMIGA_VOICES; i++, c++)
 						c->TrackMasterVolume = (uint8_t)p;
 				}
@@ -504,7 +561,7 @@ static void ProcessStep(plyVoiceTemp_t *ch)
 	}
 }
 
-static void pListCommandParse(plyVoiceTemp_t *ch, uint8_t cmd, uint8_t param)
+static void pListCommandParse(ahx_context_t *ctx, plyVoiceTemp_t *ch, uint8_t cmd, uint8_t param)
 {
 	if (cmd == 0x0) // 8bb: Init Filter Modulation
 	{
@@ -579,7 +636,7 @@ static void pListCommandParse(plyVoiceTemp_t *ch, uint8_t cmd, uint8_t param)
 	{
 		instrument_t *ins = ch->Instrument;
 		if (ins == NULL) // 8bb: safety bug-fix...
-			ins = &song.EmptyInstrument;
+			ins = &ctx->song.EmptyInstrument;
 
 		// 8bb: 4 bytes before perfList (this is apparently what AHX does...)
 		uint8_t *perfList = ins->perfList - 4;
@@ -628,25 +685,54 @@ static void pListCommandParse(plyVoiceTemp_t *ch, uint8_t cmd, uint8_t param)
 	}
 }
 
-static void ProcessFrame(plyVoiceTemp_t *ch)
+/* Square waves are sampled from the 128 byte squares at a stride for the wavelength, the
+** result only depends on the filter position, width and wavelength. These are cached as
+** images (see getImage()) and used as the square waveform in place of the voice's
+** SquareTempBuffer, so that SetAudio() can play or copy them in one go. src8 is where
+** the square is sampled from. Widths past the 32 squares (odd square limits) aren't
+** cached, NULL is returned for these, or if out of memory.
+*/
+static const int8_t *getSquareImage(ahx_context_t *ctx, const plyVoiceTemp_t *ch, const int8_t *src8, uint8_t whichSquare)
+{
+	if (whichSquare >= 32)
+		return NULL;
+
+	const int32_t filterPos = (ch->filterPos == 0 || ch->filterPos > 63) ? 0 : ch->filterPos; // 0 = EmptyFilterSection
+	const int32_t index = (((filterPos << 5) + whichSquare) * 6) + ch->Wavelength;
+
+	return getImage(&ctx->squareImages, SQUARE_IMAGES, index, src8, (1 << 5) >> ch->Wavelength, ch->Wavelength);
+}
+
+static void ProcessFrame(ahx_context_t *ctx, plyVoiceTemp_t *ch)
 {
+	song_t *song = &ctx->song;
+	const waveforms_t *waves = ctx->waves;
+
 	if (ch->HardCut != 0)
 	{
 		uint8_t track = ch->Track;
 
-		uint16_t noteNr = song.NoteNr + 1; // chk next note!
-		if (noteNr == song.TrackLength)
+		uint16_t noteNr = song->NoteNr + 1; // chk next note!
+		if (noteNr == song->TrackLength)
 		{
 			noteNr = 0; // note 0 from next pos!
 			track = ch->NextTrack;
 		}
 
-		const uint8_t *bytes = &song.TrackTable[((track << 6) + noteNr) * 3];
-
-		uint8_t nextInstr = ((bytes[0] & 3) << 4) | (bytes[1] >> 4);
+		uint8_t nextInstr;
+		if (track <= song->highestTrack)
+		{
+			nextInstr = song->TrackRows[(track << 6) + noteNr].instr;
+		}
+		else
+		{
+			// 8bb: no range check here in AHX
+			const uint8_t *bytes = &song->TrackTable[((track << 6) + noteNr) * 3];
+			nextInstr = ((bytes[0] & 3) << 4) | (bytes[1] >> 4);
+		}
 		if (nextInstr != 0)
 		{
-			int8_t range = song.Tempo - ch->HardCut; // range 1->7, tempo=6, hc=1, cut at tick 5, right
+			int8_t range = song->Tempo - ch->HardCut; // range 1->7, tempo=6, hc=1, cut at tick 5, right
 			if (range < 0)
 				range = 0; // tempo=2, hc=7, cut at tick 0 (NOW!!)
 
@@ -654,7 +740,7 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 			{
 				ch->NoteCutOn = true;
 				ch->NoteCutWait = range;
-				ch->HardCutReleaseF = 0 - (ch->NoteCutWait - song.Tempo);
+				ch->HardCutReleaseF = 0 - (ch->NoteCutWait - song->Tempo);
 			}
 
 			ch->HardCut = 0;
@@ -670,7 +756,7 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 			{
 				instrument_t *ins = ch->Instrument;
 				if (ins == NULL) // 8bb: safety bug-fix...
-					ins = &song.EmptyInstrument;
+					ins = &song->EmptyInstrument;
 
 				ch->rFrames = ch->HardCutReleaseF;
 				ch->rDelta = 0 - ((ch->adsr - (ins->rVolume << 8)) / ch->HardCutReleaseF);
@@ -690,14 +776,14 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 	if (ch->NoteDelayOn)
 	{
 		if (ch->NoteDelayWait == 0)
-			ProcessStep(ch);
+			ProcessStep(ctx, ch);
 		else
 			ch->NoteDelayWait--;
 	}
 
 	instrument_t *ins = ch->Instrument;
 	if (ins == NULL) // 8bb: safety bug-fix...
-		ins = &song.EmptyInstrument;
+		ins = &song->EmptyInstrument;
 
 	if (ch->aFrames != 0)
 	{
@@ -803,15 +889,30 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 			ch->perfWait--;
 			if (signedOverflow || (int8_t)ch->perfWait <= 0) // 8bb: signed comparison is needed here
 			{
-				const uint8_t *bytes = ch->perfList;
-
-				uint8_t cmd2 = (bytes[0] >> 5) & 7;
-				uint8_t cmd1 = (bytes[0] >> 2) & 7;
-				uint8_t wave = ((bytes[0] << 1) & 6) | (bytes[1] >> 7);
-				bool fixed = (bytes[1] >> 6) & 1;
-				uint8_t note = bytes[1] & 0x3F;
-				uint8_t param1 = bytes[2];
-				uint8_t param2 = bytes[3];
+				perfEntry_t rawEntry;
+				const perfEntry_t *entry;
+
+				// a 5xx command can make perfList run past the 256 entries, that part isn't decoded
+				const uintptr_t entryOffset = (uintptr_t)ch->perfList - (uintptr_t)(ins->perfList - 4);
+				if (entryOffset < (1+256)*4)
+				{
+					entry = &ch->InstrumentData->perfEntries[entryOffset >> 2];
+				}
+				else
+				{
+					const uint8_t *bytes = ch->perfList;
+
+					rawEntry.cmd2 = (bytes[0] >> 5) & 7;
+					rawEntry.cmd1 = (bytes[0] >> 2) & 7;
+					rawEntry.wave = ((bytes[0] << 1) & 6) | (bytes[1] >> 7);
+					rawEntry.fixed = (bytes[1] >> 6) & 1;
+					rawEntry.note = bytes[1] & 0x3F;
+					rawEntry.param1 = bytes[2];
+					rawEntry.param2 = bytes[3];
+					entry = &rawEntry;
+				}
+
+				uint8_t wave = entry->wave;
 				
 				// Check Waveform-Field from pList
 				if (wave != 0)
@@ -827,15 +928,15 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 
 				ch->periodPerfSlideOn = false;
 
-				pListCommandParse(ch, cmd1, param1); // Check Command 1 in pList
-				pListCommandParse(ch, cmd2, param2); // Check Command 2 in pList
+				pListCommandParse(ctx, ch, entry->cmd1, entry->param1); // Check Command 1 in pList
+				pListCommandParse(ctx, ch, entry->cmd2, entry->param2); // Check Command 2 in pList
 
 				// Check Note(Fixed)-Field from pList
-				if (note != 0)
+				if (entry->note != 0)
 				{
-					ch->InstrPeriod = note;
+					ch->InstrPeriod = entry->note;
 					ch->PlantPeriod = true;
-					ch->FixedNote = fixed;
+					ch->FixedNote = entry->fixed;
 				}
 
 				// End of Treatin! Goto next entry for next step!
@@ -952,7 +1053,7 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 
 		// 8bb: safety bug-fix... If filter is out of range, use empty buffer (yes, this can easily happen)
 		if (ch->filterPos == 0 || ch->filterPos > 63)
-			src8 = waves->EmptyFilterSection;
+			src8 = ctx->buffers->EmptyFilterSection;
 		else
 			src8 = (const int8_t *)&waves->squares[((int32_t)ch->filterPos - 32) * WAV_FILTER_LENGTH]; // squares@desired.filter
 
@@ -969,16 +1070,24 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 
 		src8 += whichSquare << 7; // *$80
 
-		song.WaveformTab[2] = ch->SquareTempBuffer;
+		const int8_t *squareImage = getSquareImage(ctx, ch, src8, whichSquare);
+		if (squareImage != NULL)
+		{
+			song->WaveformTab[2] = squareImage;
+		}
+		else
+		{
+			song->WaveformTab[2] = ch->SquareTempBuffer;
 
-		const int32_t delta = (1 << 5) >> ch->Wavelength;
-		const int32_t cycles = (1 << ch->Wavelength) << 2; // 8bb: <<2 since we do bytes not dwords, unlike AHX
+			const int32_t delta = (1 << 5) >> ch->Wavelength;
+			const int32_t cycles = (1 << ch->Wavelength) << 2; // 8bb: <<2 since we do bytes not dwords, unlike AHX
 
-		// And calc it, too!
-		for (int32_t i = 0; i < cycles; i++)
-		{
-			ch->SquareTempBuffer[i] = *src8;
-			src8 += delta;
+			// And calc it, too!
+			for (int32_t i = 0; i < cycles; i++)
+			{
+				ch->SquareTempBuffer[i] = *src8;
+				src8 += delta;
+			}
 		}
 
 		ch->NewWaveform = true;
@@ -992,14 +1101,14 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 	// Init the final audioPointer
 	if (ch->NewWaveform)
 	{
-		const int8_t *audioSource = song.WaveformTab[ch->Waveform];
+		const int8_t *audioSource = song->WaveformTab[ch->Waveform];
 
 		// Waveform 3 (doesn't need filter add)..
 		if (ch->Waveform != 3-1)
 		{
 			// 8bb: safety bug-fix... If filter is out of range, use empty buffer (yes, this can easily happen)
 			if (ch->filterPos == 0 || ch->filterPos > 63)
-				audioSource = waves->EmptyFilterSection;
+				audioSource = ctx->buffers->EmptyFilterSection;
 			else
 				audioSource += ((int32_t)ch->filterPos - 32) * WAV_FILTER_LENGTH;
 		}
@@ -1011,7 +1120,7 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 		// Waveform 4
 		if (ch->Waveform == 4-1)
 		{
-			uint32_t seed = song.WNRandom;
+			uint32_t seed = song->WNRandom;
 
 			audioSource += seed & ((NOIZE_SIZE-0x280) - 1);
 
@@ -1020,7 +1129,7 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 			seed += 782323;
 			seed ^= 0b1001011;
 			seed -= 6735;
-			song.WNRandom = seed;
+			song->WNRandom = seed;
 		}
 
 		ch->audioSource = audioSource;
@@ -1074,31 +1183,256 @@ static void ProcessFrame(plyVoiceTemp_t *ch)
 	ch->audioVolume = (finalVol * ch->TrackMasterVolume) >> 6;
 }
 
-void SIDInterrupt(void)
+#define AHX_STATE_NULL UINT32_MAX
+#define AHX_STATE_EMPTY_INSTRUMENT 63
+
+static bool isInBuffers(const ahx_context_t *ctx, const void *ptr) // ctx->buffers, or right past them
+{
+	const uintptr_t buffers = (uintptr_t)ctx->buffers;
+	return (uintptr_t)ptr >= buffers && (uintptr_t)ptr <= buffers+sizeof (voiceBuffers_t);
+}
+
+/* Pointers into the waveforms and instruments as offsets, so that the same state gives
+** the same numbers in every context (see hashRowState() and ahxSaveState()). The
+** waveform offsets count as if the voice buffers came right after the tables.
+*/
+static uint32_t wavesOffset(const ahx_context_t *ctx, const void *ptr)
+{
+	if (ptr == NULL)
+		return AHX_STATE_NULL;
+
+	if (isInBuffers(ctx, ptr))
+		return (uint32_t)(sizeof (waveforms_t) + ((const int8_t *)ptr - (const int8_t *)ctx->buffers));
+
+	return (uint32_t)((const int8_t *)ptr - (const int8_t *)ctx->waves);
+}
+
+static bool isSquareImage(const ahx_context_t *ctx, const void *ptr) // see getSquareImage()
+{
+	const uintptr_t tables = (uintptr_t)ctx->waves;
+	return ptr != NULL && ((uintptr_t)ptr < tables || (uintptr_t)ptr >= tables+sizeof (waveforms_t)) && !isInBuffers(ctx, ptr);
+}
+
+static instrument_t *getInstrument(song_t *song, uint32_t number)
+{
+	if (number == AHX_STATE_EMPTY_INSTRUMENT)
+		return &song->EmptyInstrument;
+
+	return (number < 63) ? song->Instruments[number] : NULL;
+}
+
+static const instrumentData_t *getInstrumentData(song_t *song, uint32_t number)
+{
+	if (number == AHX_STATE_EMPTY_INSTRUMENT)
+		return &song->EmptyInstrumentData;
+
+	return (number < 63) ? song->InstrumentData[number] : NULL;
+}
+
+static uint32_t instrumentRef(song_t *song, const void *ptr)
+{
+	if (ptr == NULL)
+		return AHX_STATE_NULL;
+
+	for (uint32_t i = 0; i <= AHX_STATE_EMPTY_INSTRUMENT; i++)
+	{
+		const uint8_t *ins = (const uint8_t *)getInstrument(song, i);
+		if (ins != NULL && (const uint8_t *)ptr >= ins && (const uint8_t *)ptr <= ins+sizeof (instrument_t))
+			return (i << 16) | (uint32_t)((const uint8_t *)ptr - ins);
+	}
+
+	return AHX_STATE_NULL; // can't happen
+}
+
+/* Loop detection, for songs that jump back (f.ex. with B-commands) before they reach
+** the end of the position list, which would otherwise be rendered to WAV forever.
+**
+** At every row boundary, the replayer state that decides what happens next is hashed,
+** if a hash comes back the song is in a loop. This is Brent's cycle detection: only one
+** row state is saved, it's moved ahead after 1, 2, 4, 8... rows, and a loop is found
+** within about twice the rows up to the end of its first pass. After that, every time
+** the saved state comes back is one more loop.
+**
+** The saved state is just some row on the loop though, so the loops are counted from
+** there, up to one loop late. ahxGetSongDurationCtx() does the second phase of Brent's
+** algorithm for the real start: the song is played again from the start with the row
+** states of one loop length kept in a ring (ctx->loopRing), and the first row state that
+** comes back one loop length later is where the loop starts. Loops are counted from it.
+**
+** The white noise seed (and the noise waveform position picked with it) is left out,
+** it practically never repeats while noise is playing. The noise just differs from
+** pass to pass. Reaching the end of the position list resets this, as that is
+** counted as a loop already.
+*/
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length) // FNV-1a
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+
+	return hash;
+}
+
+static uint64_t hashRowState(ahx_context_t *ctx)
+{
+	song_t *song = &ctx->song;
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	hash = hashBytes(hash, &song->PosNr, sizeof (song->PosNr));
+	hash = hashBytes(hash, &song->NoteNr, sizeof (song->NoteNr));
+	hash = hashBytes(hash, &song->Tempo, sizeof (song->Tempo));
+	hash = hashBytes(hash, &song->GetNewPosition, sizeof (song->GetNewPosition));
+	hash = hashBytes(hash, &song->PatternBreak, sizeof (song->PatternBreak));
+	hash = hashBytes(hash, &song->PosJump, sizeof (song->PosJump));
+	hash = hashBytes(hash, &song->PosJumpNote, sizeof (song->PosJumpNote));
+
+	// field by field, the struct padding could be anything. The pointers go in as offsets
+#define HASH_FIELD(f) hash = hashBytes(hash, &ch->f, sizeof (ch->f))
+#define HASH_OFFSET(x) offset = (x); hash = hashBytes(hash, &offset, sizeof (offset))
+	uint32_t offset;
+	const plyVoiceTemp_t *ch = song->pvt;
+	for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
+	{
+		HASH_FIELD(Track); HASH_FIELD(Transpose); HASH_FIELD(NextTrack); HASH_FIELD(NextTranspose); HASH_FIELD(adsr);
+		HASH_FIELD(aFrames); HASH_FIELD(dFrames); HASH_FIELD(sFrames); HASH_FIELD(rFrames); HASH_FIELD(aDelta);
+		HASH_FIELD(dDelta); HASH_FIELD(rDelta); HASH_FIELD(Waveform); HASH_FIELD(Wavelength);
+		HASH_FIELD(InstrPeriod); HASH_FIELD(TrackPeriod); HASH_FIELD(VibratoPeriod); HASH_FIELD(NoteMaxVolume); HASH_FIELD(perfSubVolume);
+		HASH_FIELD(TrackMasterVolume); HASH_FIELD(NewWaveform); HASH_FIELD(PlantSquare); HASH_FIELD(SquareReverse); HASH_FIELD(IgnoreSquare);
+		HASH_FIELD(PlantPeriod); HASH_FIELD(FixedNote); HASH_FIELD(volumeSlideUp); HASH_FIELD(volumeSlideDown); HASH_FIELD(HardCut);
+		HASH_FIELD(HardCutRelease); HASH_FIELD(HardCutReleaseF); HASH_FIELD(periodSlideSpeed); HASH_FIELD(periodSlidePeriod); HASH_FIELD(periodSlideLimit);
+		HASH_FIELD(periodSlideOn); HASH_FIELD(periodSlideWithLimit); HASH_FIELD(periodPerfSlideSpeed); HASH_FIELD(periodPerfSlidePeriod); HASH_FIELD(periodPerfSlideOn);
+		HASH_FIELD(vibratoDelay); HASH_FIELD(vibratoCurrent); HASH_FIELD(vibratoDepth); HASH_FIELD(vibratoSpeed); HASH_FIELD(squareOn);
+		HASH_FIELD(squareInit); HASH_FIELD(squareWait); HASH_FIELD(squareLowerLimit); HASH_FIELD(squareUpperLimit); HASH_FIELD(squarePos);
+		HASH_FIELD(squareSignum); HASH_FIELD(squareSlidingIn); HASH_FIELD(filterOn); HASH_FIELD(filterInit); HASH_FIELD(filterWait);
+		HASH_FIELD(filterLowerLimit); HASH_FIELD(filterUpperLimit); HASH_FIELD(filterPos); HASH_FIELD(filterSignum); HASH_FIELD(filterSpeed);
+		HASH_FIELD(filterSlidingIn); HASH_FIELD(IgnoreFilter); HASH_FIELD(perfCurrent); HASH_FIELD(perfSpeed); HASH_FIELD(perfWait);
+		HASH_FIELD(NoteDelayWait); HASH_FIELD(NoteDelayOn); HASH_FIELD(NoteCutWait); HASH_FIELD(NoteCutOn);
+		HASH_FIELD(audioPeriod); HASH_FIELD(audioVolume);
+
+		HASH_OFFSET(instrumentRef(song, ch->Instrument)); HASH_OFFSET(instrumentRef(song, ch->perfList));
+		HASH_OFFSET(wavesOffset(ctx, ch->audioPointer)); HASH_OFFSET(wavesOffset(ctx, ch->SquareTempBuffer));
+	}
+#undef HASH_FIELD
+#undef HASH_OFFSET
+
+	return hash;
+}
+
+static void saveRowState(song_t *song, uint64_t hash)
+{
+	loopDetect_t *d = &song->loopDetect;
+
+	d->stateHash = hash;
+	d->stateTick = song->tickCounter;
+	d->statePosNr = song->PosNr;
+	d->stateNoteNr = song->NoteNr;
+	d->rowsSinceState = 0;
+}
+
+static void countLoop(ahx_context_t *ctx) // same as reaching the end of the song
+{
+	song_t *song = &ctx->song;
+
+	if (song->loopCounter >= song->loopTimes)
+		ctx->isRecordingToWAV = false; // stop WAV recording
+	else
+		song->loopCounter++;
+}
+
+static void detectStateLoop(ahx_context_t *ctx) // call at row boundaries
+{
+	song_t *song = &ctx->song;
+	loopDetect_t *d = &song->loopDetect;
+
+	const uint64_t hash = hashRowState(ctx);
+	if (d->found)
+	{
+		if (hash == d->stateHash)
+			countLoop(ctx);
+
+		return;
+	}
+
+	if (ctx->loopRing != NULL) // second phase, the loop length is known
+	{
+		loopRow_t *r = &ctx->loopRing[d->rows % ctx->loopRingRows];
+		if (d->rows >= ctx->loopRingRows && hash == r->hash) // the row state one loop length back came back
+		{
+			d->stateHash = hash;
+			d->stateTick = r->tick;
+			d->statePosNr = r->posNr;
+			d->stateNoteNr = r->noteNr;
+			d->found = true;
+			d->loopTicks = song->tickCounter - r->tick;
+			d->loopRows = ctx->loopRingRows;
+			countLoop(ctx);
+			return;
+		}
+
+		r->hash = hash;
+		r->tick = song->tickCounter;
+		r->posNr = song->PosNr;
+		r->noteNr = song->NoteNr;
+		d->rows++;
+		return;
+	}
+
+	if (d->rowsUntilMove == 0) // first row
+	{
+		saveRowState(song, hash);
+		d->rowsUntilMove = 1;
+		return;
+	}
+
+	d->rowsSinceState++;
+	if (hash == d->stateHash)
+	{
+		d->found = true;
+		d->loopTicks = song->tickCounter - d->stateTick;
+		d->loopRows = d->rowsSinceState;
+		countLoop(ctx);
+	}
+	else if (d->rowsSinceState == d->rowsUntilMove)
+	{
+		saveRowState(song, hash);
+		d->rowsUntilMove *= 2;
+	}
+}
+
+// w = NULL: write to Paula right away, else queue the writes in w (lookahead mode)
+static void replayerTick(ahx_context_t *ctx, paulaTickWrites_t *w)
 {
 	plyVoiceTemp_t *ch;
+	song_t *song = &ctx->song;
 
-	if (!song.intPlaying)
+	if (!song->intPlaying)
 		return;
 
+	song->tickCounter++;
+
 	// set audioregisters... (8bb: yes, this is done here, NOT last like in WinAHX/AHX.cpp!)
-	ch = song.pvt;
+	ch = song->pvt;
 	for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
-		SetAudio(i, ch);
+	{
+		if (w != NULL)
+			QueueAudio(ctx, w, i, ch);
+		else
+			SetAudio(ctx, i, ch);
+	}
 
-	if (song.StepWaitFrames == 0)
+	if (song->StepWaitFrames == 0)
 	{
-		if (song.GetNewPosition)
+		if (song->GetNewPosition)
 		{
-			uint16_t posNext = song.PosNr + 1;
-			if (posNext == song.LenNr)
+			uint16_t posNext = song->PosNr + 1;
+			if (posNext == song->LenNr)
 				posNext = 0;
 
 			// get Track AND Transpose (8bb: also for next position)
-			uint8_t *posTable = &song.PosTable[song.PosNr << 3];
-			uint8_t *posTableNext = &song.PosTable[posNext << 3];
+			uint8_t *posTable = &song->PosTable[song->PosNr << 3];
+			uint8_t *posTableNext = &song->PosTable[posNext << 3];
 
-			ch = song.pvt;
+			ch = song->pvt;
 			for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
 			{
 				const int32_t offset = i << 1;
@@ -1108,230 +1442,661 @@ void SIDInterrupt(void)
 				ch->NextTranspose = posTableNext[offset+1];
 			}
 
-			song.GetNewPosition = false; // got new pos.
+			song->GetNewPosition = false; // got new pos.
 		}
 
 		// - new pos or not, now treat STEPs (means 'em notes 'emself)
-		ch = song.pvt;
+		ch = song->pvt;
 		for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
-			ProcessStep(ch);
+			ProcessStep(ctx, ch);
 
-		song.StepWaitFrames = song.Tempo;
+		song->StepWaitFrames = song->Tempo;
 	}
 
-	ch = song.pvt;
+	ch = song->pvt;
 	for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
-		ProcessFrame(ch);
+		ProcessFrame(ctx, ch);
 
-	song.StepWaitFrames--;
-	if (song.StepWaitFrames == 0)
+	song->StepWaitFrames--;
+	if (song->StepWaitFrames == 0)
 	{
-		if (!song.PatternBreak)
+		if (!song->PatternBreak)
 		{
-			song.NoteNr++;
-			if (song.NoteNr == song.TrackLength)
+			song->NoteNr++;
+			if (song->NoteNr == song->TrackLength)
 			{
 				// norm. next pos. does just position-jump!
-				song.PosJump = song.PosNr + 1;
-				song.PatternBreak = true;
+				song->PosJump = song->PosNr + 1;
+				song->PatternBreak = true;
 			}
 		}
 
-		if (song.PatternBreak)
+		if (song->PatternBreak)
 		{
-			song.PatternBreak = false;
+			song->PatternBreak = false;
 
-			song.NoteNr = song.PosJumpNote;
-			song.PosJumpNote = 0;
+			song->NoteNr = song->PosJumpNote;
+			song->PosJumpNote = 0;
 
-			song.PosNr = song.PosJump;
-			song.PosJump = 0;
+			song->PosNr = song->PosJump;
+			song->PosJump = 0;
 
-			if (song.PosNr == song.LenNr)
+			if (song->PosNr == song->LenNr)
 			{
-				song.PosNr = song.ResNr;
+				song->PosNr = song->ResNr;
 
 				// 8bb: added this (for WAV rendering)
-				if (song.loopCounter >= song.loopTimes)
-					isRecordingToWAV = false;
+				if (song->loopCounter >= song->loopTimes)
+					ctx->isRecordingToWAV = false;
 				else
-					song.loopCounter++;
+					song->loopCounter++;
+
+				memset(&song->loopDetect, 0, sizeof (loopDetect_t));
 			}
 
 			// 8bb: safety bug-fix..
-			if (song.PosNr >= song.LenNr)
+			if (song->PosNr >= song->LenNr)
 			{
-				song.PosNr = 0;
+				song->PosNr = 0;
 
 				// 8bb: added this (for WAV rendering)
-				if (song.loopCounter >= song.loopTimes)
-					isRecordingToWAV = false; // 8bb: stop WAV recording
+				if (song->loopCounter >= song->loopTimes)
+					ctx->isRecordingToWAV = false; // 8bb: stop WAV recording
 				else
-					song.loopCounter++;
+					song->loopCounter++;
+
+				memset(&song->loopDetect, 0, sizeof (loopDetect_t));
 			}
 
-			song.GetNewPosition = true;
+			song->GetNewPosition = true;
 		}
+
+		detectStateLoop(ctx);
 	}
 }
 
-/***************************************************************************
- *        PLAYER INTERFACING ROUTINES                                      *
- ***************************************************************************/
+/* Paula traces (see ahxCreateTraceCtx()). After the header, every tick is either one byte
+** TRACE_EMPTY_TICKS|(n-1) for n ticks (1..128) without writes, or a byte with a bit set for
+** every voice with writes, followed by a code byte per such voice and the values it says
+** are there (in this order):
+**  TRACE_PERIOD: the difference to the voice's last period (zigzag varint)
+**  TRACE_DATA: new voice buffer contents, one cycle of cycleLength bytes (see the code's
+**   bits 4..6) repeated over the buffer. With TRACE_DATA_FROM_WAVES it's at an offset into
+**   the waveform tables (varint), else it's the voice buffer's first cycle with a span of
+**   bytes replaced (varint start, varint length, the bytes)
+**  TRACE_VOLUME: the volume as Paula uses it (byte, 0..64)
+** Writes that wouldn't change anything aren't recorded, Paula does the same either way.
+*/
+#define AHX_TRACE_MAGIC 0x54584841 /* "AHXT" */
+#define AHX_TRACE_VERSION 1
+
+#define TRACE_PERIOD 1
+#define TRACE_VOLUME 2
+#define TRACE_DATA 4
+#define TRACE_DATA_FROM_WAVES 8
+#define TRACE_CYCLE_SHIFT 4
+#define TRACE_EMPTY_TICKS 0x80
+#define TRACE_MAX_EMPTY_TICKS 128
+
+struct ahxTrace_t // stored as-is in files
+{
+	uint32_t magic, version;
+	uint32_t numTicks, dataSize;
+	uint16_t ciaPeriod, reserved;
+	uint8_t data[];
+};
 
-void ahxNextPattern(void)
+static int32_t traceCycleLength(int32_t cycleCode) // 0..5 = 4..128 bytes, 6 = the whole buffer
+{
+	return (cycleCode < 6) ? (4 << cycleCode) : PAULA_VOICE_BUFFER_SIZE;
+}
+
+static void repeatCycle(int8_t *buffer, int32_t cycleLength)
 {
-	lockMixer();
+	for (int32_t i = cycleLength; i < PAULA_VOICE_BUFFER_SIZE; i += cycleLength)
+		memcpy(&buffer[i], buffer, cycleLength);
+}
 
-	if (song.PosNr+1 < song.LenNr)
+// Paula's registers right after ahxPlay() (see SetUpAudioChannels())
+static void resetTraceVoices(traceVoices_t *tv)
+{
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
 	{
-		song.PosJump = song.PosNr + 1;
-		song.PatternBreak = true;
-		audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
+		tv->period[i] = 0x88;
+		tv->volume[i] = 0;
 	}
 
-	unlockMixer();
+	memset(tv->voiceBuffer, 0, sizeof (tv->voiceBuffer));
 }
 
-void ahxPrevPattern(void)
+static uint8_t traceReadByte(const ahxTrace_t *trace, uint32_t *offset, bool *ok)
 {
-	lockMixer();
+	if (*offset >= trace->dataSize)
+	{
+		*ok = false;
+		return 0;
+	}
+
+	return trace->data[(*offset)++];
+}
 
-	if (song.PosNr > 0)
+static uint32_t traceReadVarint(const ahxTrace_t *trace, uint32_t *offset, bool *ok)
+{
+	uint32_t x = 0;
+	for (int32_t shift = 0; shift < 32; shift += 7)
 	{
-		song.PosJump = song.PosNr - 1;
-		song.PatternBreak = true;
-		audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
+		const uint8_t b = traceReadByte(trace, offset, ok);
+		x |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			break;
 	}
 
-	unlockMixer();
+	return x;
 }
 
-// 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
-bool ahxInit(int32_t audioFreq, int32_t audioBufferSize, int32_t masterVol, int32_t stereoSeparation)
+// decodes one voice's writes of a tick into tv, returns them as PAULA_WRITE_xxx flags
+static int32_t traceReadVoice(const ahx_context_t *ctx, const ahxTrace_t *trace, uint32_t *offset, traceVoices_t *tv, int32_t ch, bool *ok)
 {
-	ahxErrCode = ERR_SUCCESS;
+	const uint8_t code = traceReadByte(trace, offset, ok);
+	int32_t flags = 0;
 
-	if (!ahxInitWaves())
+	if (code & TRACE_PERIOD)
 	{
-		ahxErrCode = ERR_OUT_OF_MEMORY;
-		return false;
+		const uint32_t zigzag = traceReadVarint(trace, offset, ok);
+		tv->period[ch] += (uint16_t)((zigzag >> 1) ^ (0 - (zigzag & 1)));
+		flags |= PAULA_WRITE_PERIOD;
 	}
 
-	if (!paulaInit(audioFreq))
+	if (code & TRACE_DATA)
 	{
-		paulaClose();
-		ahxFreeWaves();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
-		return false;
-	}
+		const int32_t cycleCode = code >> TRACE_CYCLE_SHIFT;
+		const uint32_t cycleLength = traceCycleLength(cycleCode);
+		int8_t *buffer = tv->voiceBuffer[ch];
 
-	paulaSetStereoSeparation(stereoSeparation);
-	paulaSetMasterVolume(masterVol);
+		if (cycleCode > 6)
+			*ok = false;
 
-	if (!openMixer(audioFreq, audioBufferSize))
+		if (code & TRACE_DATA_FROM_WAVES)
+		{
+			const uint32_t tableOffset = traceReadVarint(trace, offset, ok);
+			if (tableOffset <= sizeof (waveforms_t)-cycleLength)
+				memcpy(buffer, (const int8_t *)ctx->waves + tableOffset, cycleLength);
+			else
+				*ok = false;
+		}
+		else
+		{
+			const uint32_t start = traceReadVarint(trace, offset, ok);
+			const uint32_t length = traceReadVarint(trace, offset, ok);
+			if (start <= cycleLength && length <= cycleLength-start && length <= trace->dataSize-*offset)
+			{
+				memcpy(&buffer[start], &trace->data[*offset], length);
+				*offset += length;
+			}
+			else
+			{
+				*ok = false;
+			}
+		}
+
+		repeatCycle(buffer, cycleLength);
+		flags |= PAULA_WRITE_DATA;
+	}
+
+	if (code & TRACE_VOLUME)
 	{
-		closeMixer();
-		paulaClose();
-		ahxFreeWaves();
-		ahxErrCode = ERR_AUDIO_DEVICE;
-		return false;
+		tv->volume[ch] = traceReadByte(trace, offset, ok);
+		flags |= PAULA_WRITE_VOLUME;
 	}
 
-	return true;
+	return flags;
 }
 
-void ahxClose(void)
+/* The replayer tick while a trace is played: makes the trace's next tick of Paula writes
+** (w = NULL), or queues them in w (lookahead mode). After the trace (or if it's broken),
+** the voices are muted and the trace is stopped.
+*/
+static void traceTick(ahx_context_t *ctx, paulaTickWrites_t *w)
 {
-	closeMixer();
-	paulaClose();
-	ahxFreeWaves();
-}
+	tracePlayer_t *tp = &ctx->tracePlayer;
+	const ahxTrace_t *trace = tp->trace;
+	traceVoices_t *tv = &tp->voices;
+	paula_t *p = &ctx->paula;
 
-bool ahxPlay(int32_t subSong)
-{
-	ahxErrCode = ERR_SUCCESS;
+	int32_t flags[AMIGA_VOICES] = { 0 };
+	bool ok = tp->tick < trace->numTicks;
 
-	if (!song.songLoaded)
+	if (ok && tp->emptyTicks > 0)
 	{
-		ahxErrCode = ERR_SONG_NOT_LOADED;
-		return false;
+		tp->emptyTicks--;
 	}
-
-	if (waves == NULL)
+	else if (ok)
 	{
-		ahxErrCode = ERR_NO_WAVES;
-		return false; // 8bb: waves not set up!
+		const uint8_t voiceMask = traceReadByte(trace, &tp->offset, &ok);
+		if (voiceMask & TRACE_EMPTY_TICKS)
+		{
+			tp->emptyTicks = voiceMask & ~TRACE_EMPTY_TICKS;
+		}
+		else
+		{
+			for (int32_t i = 0; i < AMIGA_VOICES; i++)
+			{
+				if (voiceMask & (1 << i))
+					flags[i] = traceReadVoice(ctx, trace, &tp->offset, tv, i, &ok);
+			}
+		}
 	}
 
-	lockMixer();
-
-	song.Subsong = 0;
-	song.PosNr = 0;
-	if (subSong > 0 && song.Subsongs > 0)
+	if (!ok)
 	{
-		subSong--;
-		if (subSong >= song.Subsongs)
-			subSong = song.Subsongs-1;
+		for (int32_t i = 0; i < AMIGA_VOICES; i++)
+		{
+			tv->volume[i] = 0;
+			flags[i] = PAULA_WRITE_VOLUME;
+		}
 
-		song.Subsong = (uint8_t)(subSong + 1);
-		song.PosNr = song.SubSongTable[subSong];
+		tp->trace = NULL;
+		ctx->isRecordingToWAV = false;
+	}
+	else if (++tp->tick == trace->numTicks)
+	{
+		ctx->isRecordingToWAV = false; // the last tick, like at the end of a song
 	}
-
-	song.StepWaitFrames = 0;
-	song.GetNewPosition = true;
-	song.NoteNr = 0;
-
-	ahxQuietAudios();
 
 	for (int32_t i = 0; i < AMIGA_VOICES; i++)
-		InitVoiceXTemp(&song.pvt[i]);
-
-	SetUpAudioChannels();
-	amigaSetCIAPeriod(song.SongCIAPeriod);
+	{
+		if (w != NULL)
+		{
+			w->flags[i] = (uint8_t)flags[i];
+			w->period[i] = tv->period[i];
+			w->volume[i] = tv->volume[i];
+			if (flags[i] & PAULA_WRITE_DATA)
+			{
+				w->dataTarget[i] = ctx->buffers->currentVoice[i];
+				memcpy(w->data[i], tv->voiceBuffer[i], PAULA_VOICE_BUFFER_SIZE);
+			}
+		}
+		else
+		{
+			if (flags[i] & PAULA_WRITE_PERIOD)
+				paulaSetPeriod(p, i, tv->period[i]);
 
-	// 8bb: Added this. Clear custom data (these are put in the waves struct for dword-alignment)
-	memset(waves->SquareTempBuffer,   0, sizeof (waves->SquareTempBuffer));
-	memset(waves->currentVoice,       0, sizeof (waves->currentVoice));
-	memset(waves->EmptyFilterSection, 0, sizeof (waves->EmptyFilterSection));
+			if (flags[i] & PAULA_WRITE_DATA)
+				memcpy(ctx->buffers->currentVoice[i], tv->voiceBuffer[i], PAULA_VOICE_BUFFER_SIZE);
 
-	plyVoiceTemp_t *ch = song.pvt;
+			if (flags[i] & PAULA_WRITE_VOLUME)
+				paulaSetVolume(p, i, tv->volume[i]);
+		}
+	}
+}
+
+void SIDInterruptCtx(ahx_context_t *ctx)
+{
+	if (ctx->tracePlayer.trace != NULL)
+		traceTick(ctx, NULL);
+	else
+		replayerTick(ctx, NULL);
+}
+
+void SIDInterrupt(void)
+{
+	SIDInterruptCtx(&ahxDefaultContext);
+}
+
+/* In lookahead mode, the song state runs up to the length of the queue ahead of what
+** Paula plays. The replayer state from before each queued tick is kept, so that what
+** pairs the song state with Paula's (saving a state, seeking, changing pattern) can use
+** the one that goes with Paula's: the one from before the oldest queued tick. Only a
+** playing song is put back, a stopped one doesn't change on ticks (and could have been
+** freed since). Only call these while the mixer is locked (the replayer thread saves the
+** states while it holds the queue, see paulaBeginTickWrites()).
+*/
+static void saveLookaheadState(const ahx_context_t *ctx, lookaheadState_t *l)
+{
+	l->song = ctx->song;
+	memcpy(l->SquareTempBuffer, ctx->buffers->SquareTempBuffer, sizeof (l->SquareTempBuffer));
+}
+
+static void loadLookaheadState(ahx_context_t *ctx, const lookaheadState_t *l)
+{
+	ctx->song = l->song;
+	memcpy(ctx->buffers->SquareTempBuffer, l->SquareTempBuffer, sizeof (l->SquareTempBuffer));
+}
+
+static const lookaheadState_t *queuedTickState(const ahx_context_t *ctx) // NULL if none (or not needed)
+{
+	const paula_t *p = &ctx->paula;
+	if (ctx->lookaheadStates == NULL || p->tickQueueSize != ctx->numLookaheadStates || p->tickQueueHead == p->tickQueueTail)
+		return NULL;
+
+	const lookaheadState_t *l = &ctx->lookaheadStates[p->tickQueueTail % p->tickQueueSize];
+	return l->song.intPlaying ? l : NULL;
+}
+
+// drops the queued ticks, and puts the song back to the tick Paula is at
+static void syncLookahead(ahx_context_t *ctx)
+{
+	const lookaheadState_t *l = queuedTickState(ctx);
+	if (l != NULL)
+		loadLookaheadState(ctx, l);
+
+	paulaDiscardTickWrites(&ctx->paula);
+}
+
+static void freeLookaheadStates(ahx_context_t *ctx)
+{
+	if (ctx->lookaheadStates != NULL)
+	{
+		free(ctx->lookaheadStates);
+		ctx->lookaheadStates = NULL;
+	}
+
+	ctx->numLookaheadStates = 0;
+}
+
+bool ahxSetLookaheadCtx(ahx_context_t *ctx, int32_t numTicks)
+{
+	ctx->errCode = ERR_SUCCESS;
+
+	lookaheadState_t *states = NULL;
+	if (numTicks > 0)
+	{
+		states = (lookaheadState_t *)malloc(numTicks * sizeof (lookaheadState_t));
+		if (states == NULL)
+		{
+			ctx->errCode = ERR_OUT_OF_MEMORY;
+			return false;
+		}
+	}
+
+	// the song continues from what was heard, not from where it had run ahead to
+	paulaLockMixer(&ctx->paula);
+	syncLookahead(ctx);
+	paulaUnlockMixer(&ctx->paula);
+
+	if (!paulaSetLookahead(&ctx->paula, numTicks))
+	{
+		if (states != NULL)
+			free(states);
+
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	freeLookaheadStates(ctx);
+	ctx->lookaheadStates = states;
+	ctx->numLookaheadStates = (states != NULL) ? numTicks : 0;
+	return true;
+}
+
+int32_t ahxRunLookaheadCtx(ahx_context_t *ctx)
+{
+	paula_t *p = &ctx->paula;
+
+	paulaTickWrites_t *w;
+	int32_t numTicks = 0;
+	while ((w = paulaBeginTickWrites(p)) != NULL)
+	{
+		if (p->tickQueueSize == ctx->numLookaheadStates)
+			saveLookaheadState(ctx, &ctx->lookaheadStates[p->tickQueueHead % p->tickQueueSize]);
+
+		if (ctx->tracePlayer.trace != NULL)
+			traceTick(ctx, w);
+		else
+			replayerTick(ctx, w);
+		paulaEndTickWrites(p);
+		numTicks++;
+	}
+
+	return numTicks;
+}
+
+bool ahxSetLookahead(int32_t numTicks)
+{
+	return ahxSetLookaheadCtx(&ahxDefaultContext, numTicks);
+}
+
+int32_t ahxRunLookahead(void)
+{
+	return ahxRunLookaheadCtx(&ahxDefaultContext);
+}
+
+/***************************************************************************
+ *        PLAYER INTERFACING ROUTINES                                      *
+ ***************************************************************************/
+
+void ahxNextPatternCtx(ahx_context_t *ctx)
+{
+	song_t *song = &ctx->song;
+
+	paulaLockMixer(&ctx->paula);
+	syncLookahead(ctx); // from the pattern that's heard
+
+	if (song->PosNr+1 < song->LenNr)
+	{
+		song->PosJump = song->PosNr + 1;
+		song->PatternBreak = true;
+		ctx->paula.audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
+	}
+
+	paulaUnlockMixer(&ctx->paula);
+}
+
+void ahxPrevPatternCtx(ahx_context_t *ctx)
+{
+	song_t *song = &ctx->song;
+
+	paulaLockMixer(&ctx->paula);
+	syncLookahead(ctx); // from the pattern that's heard
+
+	if (song->PosNr > 0)
+	{
+		song->PosJump = song->PosNr - 1;
+		song->PatternBreak = true;
+		ctx->paula.audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
+	}
+
+	paulaUnlockMixer(&ctx->paula);
+}
+
+void ahxNextPattern(void)
+{
+	ahxNextPatternCtx(&ahxDefaultContext);
+}
+
+void ahxPrevPattern(void)
+{
+	ahxPrevPatternCtx(&ahxDefaultContext);
+}
+
+static bool initContext(ahx_context_t *ctx, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation, int32_t quality)
+{
+	ctx->errCode = ERR_SUCCESS;
+
+	if (!ahxInitWaves(ctx))
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	if (!paulaInit(&ctx->paula, audioFreq, quality))
+	{
+		paulaClose(&ctx->paula);
+		ahxFreeWaves(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	paulaSetStereoSeparationCtx(ctx, stereoSeparation);
+	paulaSetMasterVolumeCtx(ctx, masterVol);
+
+	return true;
+}
+
+// masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20), quality = PAULA_QUALITY_xxx
+ahx_context_t *ahxCreateContext(int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation, int32_t quality)
+{
+	ahx_context_t *ctx = (ahx_context_t *)calloc(1, sizeof (ahx_context_t));
+	if (ctx == NULL)
+		return NULL;
+
+	if (!initContext(ctx, audioFreq, masterVol, stereoSeparation, quality))
+	{
+		free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+void ahxDestroyContext(ahx_context_t *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	ahxFreeCtx(ctx);
+	paulaClose(&ctx->paula);
+	freeLookaheadStates(ctx);
+	ahxFreeWaves(ctx);
+	free(ctx);
+}
+
+// 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
+// quality = PAULA_QUALITY_xxx (default = PAULA_QUALITY_BLEP)
+bool ahxInit(int32_t audioFreq, int32_t audioBufferSize, int32_t masterVol, int32_t stereoSeparation, int32_t quality)
+{
+	ahx_context_t *ctx = &ahxDefaultContext;
+
+	if (!initContext(ctx, audioFreq, masterVol, stereoSeparation, quality))
+		return false;
+
+	ctx->paula.usesAudioDevice = true;
+	if (!openMixer(audioFreq, audioBufferSize))
+	{
+		ctx->paula.usesAudioDevice = false;
+		closeMixer();
+		paulaClose(&ctx->paula);
+		ahxFreeWaves(ctx);
+		ctx->errCode = ERR_AUDIO_DEVICE;
+		return false;
+	}
+
+	return true;
+}
+
+void ahxClose(void)
+{
+	closeMixer();
+	ahxDefaultContext.paula.usesAudioDevice = false;
+	paulaClose(&ahxDefaultContext.paula);
+	freeLookaheadStates(&ahxDefaultContext);
+	ahxFreeWaves(&ahxDefaultContext);
+}
+
+bool ahxPlayCtx(ahx_context_t *ctx, int32_t subSong)
+{
+	song_t *song = &ctx->song;
+	voiceBuffers_t *buffers = ctx->buffers;
+	paula_t *p = &ctx->paula;
+
+	ctx->errCode = ERR_SUCCESS;
+
+	if (!song->songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	if (buffers == NULL)
+	{
+		ctx->errCode = ERR_NO_WAVES;
+		return false; // 8bb: waves not set up!
+	}
+
+	paulaLockMixer(p);
+	syncLookahead(ctx); // not all of the song state is reset
+
+	song->Subsong = 0;
+	song->PosNr = 0;
+	if (subSong > 0 && song->Subsongs > 0)
+	{
+		subSong--;
+		if (subSong >= song->Subsongs)
+			subSong = song->Subsongs-1;
+
+		song->Subsong = (uint8_t)(subSong + 1);
+		song->PosNr = song->SubSongTable[subSong];
+	}
+
+	song->StepWaitFrames = 0;
+	song->GetNewPosition = true;
+	song->NoteNr = 0;
+
+	ahxQuietAudios(ctx);
+
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+		InitVoiceXTemp(&song->pvt[i]);
+
+	SetUpAudioChannels(ctx);
+	amigaSetCIAPeriod(p, song->SongCIAPeriod);
+
+	// 8bb: Added this. Clear custom data (these are put in the waves struct for dword-alignment)
+	memset(buffers->SquareTempBuffer,   0, sizeof (buffers->SquareTempBuffer));
+	memset(buffers->currentVoice,       0, sizeof (buffers->currentVoice));
+	memset(buffers->EmptyFilterSection, 0, sizeof (buffers->EmptyFilterSection));
+
+	plyVoiceTemp_t *ch = song->pvt;
 	for (int32_t i = 0; i < AMIGA_VOICES; i++, ch++)
-		ch->SquareTempBuffer = waves->SquareTempBuffer[i];
+		ch->SquareTempBuffer = buffers->SquareTempBuffer[i];
 
-	song.PosJump = false;
-	song.Tempo = 6;
-	song.intPlaying = true;
+	song->PosJump = false;
+	song->Tempo = 6;
+	song->intPlaying = true;
 
-	song.loopCounter = 0;
-	song.loopTimes = 0; // 8bb: updated later in WAV writing mode
+	song->loopCounter = 0;
+	song->loopTimes = 0; // 8bb: updated later in WAV writing mode
+	song->tickCounter = 0;
+	memset(&song->loopDetect, 0, sizeof (loopDetect_t));
 
-	audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
+	p->audio.tickSampleCounter64 = 0; // 8bb: clear tick sample counter so that it will instantly initiate a tick
 
-	paulaClearFilterState();
-	resetCachedMixerPeriod();
-	resetAudioDithering();
+	paulaClearFilterState(p);
+	resetCachedMixerPeriod(p);
+	resetAudioDithering(p);
 
-	song.dBPM = amigaCIAPeriod2Hz(song.SongCIAPeriod) * 2.5;
+	song->dBPM = amigaCIAPeriod2Hz(song->SongCIAPeriod) * 2.5;
 
-	song.WNRandom = 0; // 8bb: Clear RNG seed (AHX doesn't do this)
+	song->WNRandom = 0; // 8bb: Clear RNG seed (AHX doesn't do this)
 
-	unlockMixer();
+	ctx->tracePlayer.trace = NULL;
+	paulaUnlockMixer(p);
 
 	return true;
 }
 
-void ahxStop(void)
+void ahxStopCtx(ahx_context_t *ctx)
 {
-	lockMixer();
+	paulaLockMixer(&ctx->paula);
+	syncLookahead(ctx);
 
-	song.intPlaying = false;
-	ahxQuietAudios();
+	ctx->song.intPlaying = false;
+	ahxQuietAudios(ctx);
 
 	for (int32_t i = 0; i < AMIGA_VOICES; i++)
-		InitVoiceXTemp(&song.pvt[i]);
+		InitVoiceXTemp(&ctx->song.pvt[i]);
+
+	ctx->tracePlayer.trace = NULL;
+	paulaUnlockMixer(&ctx->paula);
+}
+
+bool ahxPlay(int32_t subSong)
+{
+	return ahxPlayCtx(&ahxDefaultContext, subSong);
+}
 
-	unlockMixer();
+void ahxStop(void)
+{
+	ahxStopCtx(&ahxDefaultContext);
 }
 
 /***************************************************************************
@@ -1379,201 +2144,1806 @@ static void finishWAVHeader(FILE *f, uint32_t numDataBytes)
 	fwrite(&numDataBytes, 4, 1, f);
 }
 
-static int32_t ahxGetFrame(int16_t *streamOut) // 8bb: returns bytes mixed
+static int32_t ahxGetFrame(ahx_context_t *ctx, int16_t *streamOut) // 8bb: returns bytes mixed
 {
-	if (audio.tickSampleCounter64 <= 0) // 8bb: new replayer tick
+	audio_t *audio = &ctx->paula.audio;
+
+	if (audio->tickSampleCounter64 <= 0) // 8bb: new replayer tick
 	{
-		SIDInterrupt();
-		audio.tickSampleCounter64 += audio.samplesPerTick64;
+		SIDInterruptCtx(ctx);
+		audio->tickSampleCounter64 += audio->samplesPerTick64;
 	}
 
-	const int32_t samplesToMix = (audio.tickSampleCounter64 + UINT32_MAX) >> 32; // 8bb: ceil (rounded upwards)
+	const int32_t samplesToMix = (audio->tickSampleCounter64 + UINT32_MAX) >> 32; // 8bb: ceil (rounded upwards)
 
-	paulaMixSamples(streamOut, samplesToMix);
+	paulaMixSamplesCtx(ctx, streamOut, samplesToMix);
 	streamOut += samplesToMix * 2;
 
-	audio.tickSampleCounter64 -= (int64_t)samplesToMix << 32;
+	audio->tickSampleCounter64 -= (int64_t)samplesToMix << 32;
 
 	return samplesToMix * 2 * sizeof (short);
 }
 
-// 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
-bool ahxRecordWAVFromRAM(const uint8_t *data, const char *fileOut, int32_t subSong,
-	int32_t songLoopTimes, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation)
+// renders the song loaded in the context, the context has to be initialized
+static bool recordWAV(ahx_context_t *ctx, const char *fileOut, int32_t subSong, int32_t songLoopTimes)
 {
-	ahxErrCode = ERR_SUCCESS;
-
-	if (!ahxInitWaves())
-	{
-		ahxErrCode = ERR_OUT_OF_MEMORY;
-		return false;
-	}
-
-	if (!paulaInit(audioFreq))
-	{
-		ahxFreeWaves();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
-		return false;
-	}
-
-	paulaSetStereoSeparation(stereoSeparation);
-	paulaSetMasterVolume(masterVol);
+	const int32_t audioFreq = ctx->paula.audio.outputFreq;
+	const int32_t maxSamplesPerTick = (int32_t)ceil(audioFreq / amigaCIAPeriod2Hz(AHX_HIGHEST_CIA_PERIOD));
 
-	if (!ahxLoadFromRAM(data)) // 8bb: modifies error code
+	// the replayer counts the loops of a song stuck in a loop late, the dry run knows where they start (see detectStateLoop())
+	songDuration_t duration;
+	if (!ahxGetSongDurationCtx(ctx, subSong, songLoopTimes, audioFreq, &duration)) // modifies error code
 	{
-		paulaClose();
-		ahxFreeWaves();
+		ahxFreeCtx(ctx);
 		return false;
 	}
 
-	const int32_t maxSamplesPerTick = (int32_t)ceil(audioFreq / amigaCIAPeriod2Hz(AHX_HIGHEST_CIA_PERIOD));
-
 	int16_t *outputBuffer = (int16_t *)malloc(maxSamplesPerTick * (2 * sizeof (int16_t)));
 	if (outputBuffer == NULL)
 	{
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+		ahxFreeCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
 		return false;
 	}
 
 	FILE *f = fopen(fileOut, "wb");
 	if (f == NULL)
 	{
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
+		ahxFreeCtx(ctx);
 		free(outputBuffer);
-		ahxErrCode = ERR_FILE_IO;
+		ctx->errCode = ERR_FILE_IO;
 		return false;
 	}
 
 	writeWAVHeader(f, audioFreq);
 
-	isRecordingToWAV = true;
-	if (!ahxPlay(subSong)) // 8bb: modifies error code (also resets audio.tickSampleCounter64)
+	ctx->isRecordingToWAV = true;
+	if (!ahxPlayCtx(ctx, subSong)) // 8bb: modifies error code (also resets audio.tickSampleCounter64)
 	{
-		isRecordingToWAV = false;
+		ctx->isRecordingToWAV = false;
 		fclose(f);
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
+		ahxFreeCtx(ctx);
 		free(outputBuffer);
 		return false;
 	}
 
-	song.loopTimes = songLoopTimes;
+	ctx->song.loopTimes = songLoopTimes;
 
 	uint32_t totalBytes = 0;
-	while (isRecordingToWAV)
+	while (ctx->isRecordingToWAV && ctx->song.tickCounter < duration.numTicks)
 	{
-		const int32_t bytesMixed = ahxGetFrame(outputBuffer);
+		const int32_t bytesMixed = ahxGetFrame(ctx, outputBuffer);
 		fwrite(outputBuffer, 1, bytesMixed, f);
 		totalBytes += bytesMixed;
 	}
 
 	finishWAVHeader(f, totalBytes);
-	isRecordingToWAV = false;
+	ctx->isRecordingToWAV = false;
 
 	fclose(f);
-	ahxFree();
-	paulaClose();
-	ahxFreeWaves();
+	ahxFreeCtx(ctx);
 	free(outputBuffer);
 
 	return true;
 }
 
+bool ahxRecordWAVFromRAMCtx(ahx_context_t *ctx, const uint8_t *data, const char *fileOut, int32_t subSong, int32_t songLoopTimes)
+{
+	if (!ahxLoadFromRAMCtx(ctx, data)) // 8bb: modifies error code
+		return false;
+
+	return recordWAV(ctx, fileOut, subSong, songLoopTimes);
+}
+
 // 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
-bool ahxRecordWAV(const char *fileIn, const char *fileOut, int32_t subSong,
+bool ahxRecordWAVFromRAM(const uint8_t *data, const char *fileOut, int32_t subSong,
 	int32_t songLoopTimes, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation)
 {
-	ahxErrCode = ERR_SUCCESS;
+	ahx_context_t *ctx = &ahxDefaultContext;
 
-	if (!ahxInitWaves())
-	{
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+	if (!initContext(ctx, audioFreq, masterVol, stereoSeparation, PAULA_QUALITY_BLEP)) // WAV rendering is always done at full quality
 		return false;
-	}
 
-	if (!paulaInit(audioFreq))
-	{
-		ahxFreeWaves();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
-		return false;
-	}
+	const bool result = ahxRecordWAVFromRAMCtx(ctx, data, fileOut, subSong, songLoopTimes);
 
-	paulaSetStereoSeparation(stereoSeparation);
-	paulaSetMasterVolume(masterVol);
+	paulaClose(&ctx->paula);
+	ahxFreeWaves(ctx);
 
-	if (!ahxLoad(fileIn)) // 8bb: modifies error code
-	{
-		paulaClose();
-		ahxFreeWaves();
-		return false;
-	}
+	return result;
+}
 
-	const int32_t maxSamplesPerTick = (int32_t)ceil(audioFreq / amigaCIAPeriod2Hz(AHX_HIGHEST_CIA_PERIOD));
+// 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
+bool ahxRecordWAV(const char *fileIn, const char *fileOut, int32_t subSong,
+	int32_t songLoopTimes, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation)
+{
+	ahx_context_t *ctx = &ahxDefaultContext;
 
-	int16_t *outputBuffer = (int16_t *)malloc(maxSamplesPerTick * (2 * sizeof (int16_t)));
-	if (outputBuffer == NULL)
-	{
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
-		ahxErrCode = ERR_OUT_OF_MEMORY;
+	if (!initContext(ctx, audioFreq, masterVol, stereoSeparation, PAULA_QUALITY_BLEP)) // WAV rendering is always done at full quality
 		return false;
-	}
 
-	FILE *f = fopen(fileOut, "wb");
-	if (f == NULL)
-	{
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
-		free(outputBuffer);
-		ahxErrCode = ERR_FILE_IO;
+	bool result = false;
+	if (ahxLoadCtx(ctx, fileIn)) // 8bb: modifies error code
+		result = recordWAV(ctx, fileOut, subSong, songLoopTimes);
+
+	paulaClose(&ctx->paula);
+	ahxFreeWaves(ctx);
+
+	return result;
+}
+
+static uint64_t ticksToSamples(int64_t samplesPerTick64, uint32_t numTicks) // sum of the rounded tick lengths
+{
+	// ceil(numTicks * samplesPerTick), split up to not overflow 64 bits
+	const uint64_t intPart = (uint64_t)numTicks * (uint64_t)(samplesPerTick64 >> 32);
+	const uint64_t fracPart = ((uint64_t)numTicks * (uint64_t)(samplesPerTick64 & UINT32_MAX) + UINT32_MAX) >> 32;
+
+	return intPart + fracPart;
+}
+
+bool ahxGetSongDurationCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t audioFreq, songDuration_t *duration)
+{
+	song_t *song = &ctx->song;
+	paula_t *p = &ctx->paula;
+
+	memset(duration, 0, sizeof (songDuration_t));
+
+	if (!ahxPlayCtx(ctx, subSong)) // modifies error code
 		return false;
-	}
 
-	writeWAVHeader(f, audioFreq);
+	// the tick lengths are rounded like in paulaOutputSamples()/ahxGetFrame()
+	const int64_t samplesPerTick64 = amigaCIAPeriod2SamplesPerTick64(song->SongCIAPeriod, CLAMP(audioFreq, PAULA_MIN_FREQ, PAULA_MAX_FREQ));
 
-	isRecordingToWAV = true;
-	if (!ahxPlay(subSong)) // 8bb: modifies error code (also resets audio.tickSampleCounter64)
+	paulaLockMixer(p);
+
+	ctx->isRecordingToWAV = true; // cleared by the replayer when the song ends (see SIDInterruptCtx())
+	song->loopTimes = songLoopTimes;
+
+	while (ctx->isRecordingToWAV && song->tickCounter < AHX_RENDER_MAX_TICKS)
 	{
-		isRecordingToWAV = false;
-		fclose(f);
-		ahxFree();
-		paulaClose();
-		ahxFreeWaves();
-		free(outputBuffer);
-		return false;
+		const int32_t loopCounter = song->loopCounter;
+		SIDInterruptCtx(ctx);
+
+		// a loop was counted (an F00 stop leaves the tempo at zero)
+		if (song->loopCounter == loopCounter && (ctx->isRecordingToWAV || song->Tempo == 0))
+			continue;
+
+		if (song->loopDetect.found && ctx->loopRing == NULL)
+		{
+			// only the loop's length is known yet, play the song again to find where it starts (see detectStateLoop())
+			ctx->loopRing = (loopRow_t *)malloc(song->loopDetect.loopRows * sizeof (loopRow_t));
+			if (ctx->loopRing == NULL)
+			{
+				ctx->isRecordingToWAV = false;
+				paulaUnlockMixer(p);
+
+				ahxStopCtx(ctx);
+				ctx->errCode = ERR_OUT_OF_MEMORY;
+				return false;
+			}
+
+			ctx->loopRingRows = song->loopDetect.loopRows;
+			memset(duration, 0, sizeof (songDuration_t));
+
+			paulaUnlockMixer(p);
+			ahxPlayCtx(ctx, subSong);
+			paulaLockMixer(p);
+
+			ctx->isRecordingToWAV = true;
+			song->loopTimes = songLoopTimes;
+			continue;
+		}
+
+		if (song->loopDetect.found) // jumped back to a row state seen before
+		{
+			duration->looped = true;
+			duration->loopPosNr = song->loopDetect.statePosNr;
+			duration->loopNoteNr = song->loopDetect.stateNoteNr;
+			duration->loopTick = song->loopDetect.stateTick;
+			duration->loopTicks = song->loopDetect.loopTicks;
+		}
+		else if (!duration->looped) // reached the end of the position list
+		{
+			duration->looped = true;
+			duration->loopPosNr = song->PosNr;
+			duration->loopNoteNr = song->NoteNr;
+			duration->loopTick = song->tickCounter;
+		}
+		else if (duration->loopTicks == 0)
+		{
+			duration->loopTicks = song->tickCounter - duration->loopTick;
+		}
 	}
 
-	song.loopTimes = songLoopTimes;
+	duration->numTicks = song->tickCounter;
+	duration->numSamples = ticksToSamples(samplesPerTick64, duration->numTicks);
+	duration->loopSample = ticksToSamples(samplesPerTick64, duration->loopTick);
+	duration->ended = !ctx->isRecordingToWAV;
+	ctx->isRecordingToWAV = false;
 
-	uint32_t totalBytes = 0;
-	while (isRecordingToWAV)
+	if (ctx->loopRing != NULL)
 	{
-		const uint32_t size = ahxGetFrame(outputBuffer);
-		fwrite(outputBuffer, 1, size, f);
-		totalBytes += size;
+		free(ctx->loopRing);
+		ctx->loopRing = NULL;
 	}
 
-	finishWAVHeader(f, totalBytes);
-	isRecordingToWAV = false;
-
-	fclose(f);
-	ahxFree();
-	paulaClose();
-	ahxFreeWaves();
-	free(outputBuffer);
+	paulaUnlockMixer(p);
 
+	ahxStopCtx(ctx);
 	return true;
 }
 
-int32_t ahxGetErrorCode(void)
+/* Player state snapshots (see ahxSaveState() in replayer.h).
+**
+** Pointers are stored as offsets: into the waveforms (waves and buffers, see wavesOffset()),
+** or into an instrument as (instrument number << 16) | byte offset, where number 63 is
+** song->EmptyInstrument. Paula's are offsets into the voice buffers.
+** The song data itself is not saved, only a hash of it to check that a snapshot is
+** loaded into a context with the same song.
+*/
+#define AHX_STATE_MAGIC 0x53584841 /* "AHXS" */
+#define AHX_STATE_VERSION 4
+
+typedef struct ahxState_t
+{
+	uint32_t magic, version, size;
+	int32_t outputFreq;
+	uint64_t songHash;
+
+	// song_t
+	bool intPlaying, GetNewPosition, PatternBreak;
+	uint8_t Subsong, Tempo;
+	uint16_t SongCIAPeriod, StepWaitFrames, PosJump, PosJumpNote, NoteNr, PosNr;
+	uint32_t WNRandom, tickCounter, squareWaveOffset; // squareWaveOffset = song->WaveformTab[2]
+	int32_t loopCounter, loopTimes;
+	loopDetect_t loopDetect;
+	double dBPM;
+
+	plyVoiceTemp_t pvt[AMIGA_VOICES]; // the pointers are NULL, see below
+	uint32_t instrumentRef[AMIGA_VOICES], perfListRef[AMIGA_VOICES];
+	uint32_t audioPointerOffset[AMIGA_VOICES], audioSourceOffset[AMIGA_VOICES], squareTempBufferOffset[AMIGA_VOICES];
+
+	paulaState_t paula;
+
+	// the parts of the voice buffers that the replayer writes to
+	int8_t SquareTempBuffer[AMIGA_VOICES][0x80];
+	int8_t currentVoice[AMIGA_VOICES][0x280];
+} ahxState_t;
+
+static uint64_t hashSong(const song_t *song)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	hash = hashBytes(hash, &song->LenNr, sizeof (song->LenNr));
+	hash = hashBytes(hash, &song->ResNr, sizeof (song->ResNr));
+	hash = hashBytes(hash, &song->TrackLength, sizeof (song->TrackLength));
+	hash = hashBytes(hash, &song->highestTrack, sizeof (song->highestTrack));
+	hash = hashBytes(hash, &song->numInstruments, sizeof (song->numInstruments));
+	hash = hashBytes(hash, song->PosTable, song->LenNr * 8);
+	hash = hashBytes(hash, song->TrackTable, (song->highestTrack + 1) * (3*64));
+
+	for (int32_t i = 0; i < 63; i++)
+	{
+		if (song->Instruments[i] != NULL)
+			hash = hashBytes(hash, song->Instruments[i], sizeof (instrument_t));
+	}
+
+	return hash;
+}
+
+// a wavesOffset() that has to be in the voice buffers, with numBytes from there on
+static int8_t *buffersPointer(const ahx_context_t *ctx, uint32_t offset, uint32_t numBytes, bool *ok)
+{
+	if (offset == AHX_STATE_NULL)
+		return NULL;
+
+	if (offset < sizeof (waveforms_t) || (uint64_t)(offset-sizeof (waveforms_t)) + numBytes > sizeof (voiceBuffers_t))
+	{
+		*ok = false;
+		return NULL;
+	}
+
+	return (int8_t *)ctx->buffers + (offset - sizeof (waveforms_t));
+}
+
+static const int8_t *wavesPointer(const ahx_context_t *ctx, uint32_t offset, uint32_t numBytes, bool *ok)
+{
+	if (offset == AHX_STATE_NULL)
+		return NULL;
+
+	if (offset < sizeof (waveforms_t))
+	{
+		if ((uint64_t)offset + numBytes > sizeof (waveforms_t))
+		{
+			*ok = false;
+			return NULL;
+		}
+
+		return (const int8_t *)ctx->waves + offset;
+	}
+
+	return buffersPointer(ctx, offset, numBytes, ok);
+}
+
+static uint8_t *instrumentPointer(song_t *song, uint32_t ref, bool *ok)
+{
+	if (ref == AHX_STATE_NULL)
+		return NULL;
+
+	uint8_t *ins = (uint8_t *)getInstrument(song, ref >> 16);
+	if (ins == NULL || (ref & 0xFFFF) > sizeof (instrument_t))
+	{
+		*ok = false;
+		return NULL;
+	}
+
+	return ins + (ref & 0xFFFF);
+}
+
+// only call this while the mixer is locked
+static void saveState(ahx_context_t *ctx, ahxState_t *s)
+{
+	song_t *song = &ctx->song;
+	voiceBuffers_t *buffers = ctx->buffers;
+
+	memset(s, 0, sizeof (ahxState_t));
+	s->magic = AHX_STATE_MAGIC;
+	s->version = AHX_STATE_VERSION;
+	s->size = sizeof (ahxState_t);
+	s->outputFreq = ctx->paula.audio.outputFreq;
+	s->songHash = hashSong(song);
+
+	s->intPlaying = song->intPlaying;
+	s->GetNewPosition = song->GetNewPosition;
+	s->PatternBreak = song->PatternBreak;
+	s->Subsong = song->Subsong;
+	s->Tempo = song->Tempo;
+	s->SongCIAPeriod = song->SongCIAPeriod;
+	s->StepWaitFrames = song->StepWaitFrames;
+	s->PosJump = song->PosJump;
+	s->PosJumpNote = song->PosJumpNote;
+	s->NoteNr = song->NoteNr;
+	s->PosNr = song->PosNr;
+	s->WNRandom = song->WNRandom;
+	s->tickCounter = song->tickCounter;
+	s->squareWaveOffset = wavesOffset(ctx, isSquareImage(ctx, song->WaveformTab[2]) ? buffers->SquareTempBuffer[0] : song->WaveformTab[2]);
+	s->loopCounter = song->loopCounter;
+	s->loopTimes = song->loopTimes;
+	s->loopDetect = song->loopDetect;
+	s->dBPM = song->dBPM;
+
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+	{
+		const plyVoiceTemp_t *ch = &song->pvt[i];
+		plyVoiceTemp_t *chOut = &s->pvt[i];
+
+		*chOut = *ch;
+		chOut->Instrument = NULL;
+		chOut->InstrumentData = NULL;
+		chOut->perfList = NULL;
+		chOut->audioPointer = NULL;
+		chOut->audioSource = NULL;
+		chOut->SquareTempBuffer = NULL;
+
+		s->instrumentRef[i] = instrumentRef(song, ch->Instrument);
+		s->perfListRef[i] = instrumentRef(song, ch->perfList);
+		s->audioPointerOffset[i] = wavesOffset(ctx, ch->audioPointer);
+		s->audioSourceOffset[i] = wavesOffset(ctx, ch->audioSource);
+		s->squareTempBufferOffset[i] = wavesOffset(ctx, ch->SquareTempBuffer);
+	}
+
+	paulaSaveState(&ctx->paula, (const int8_t *)buffers, &s->paula);
+
+	memcpy(s->currentVoice, buffers->currentVoice, sizeof (s->currentVoice));
+
+	/* Only the square a voice is playing is saved from its SquareTempBuffer, the rest of
+	** the buffers is zeroed. They are left with whatever square was calculated in them
+	** last, which depends on what the square cache had, and is calculated again before
+	** it's played. A voice playing a cached square is saved as playing it from its
+	** SquareTempBuffer, as if it wasn't cached. WaveformTab[2] is set again before it's used.
+	*/
+	memset(s->SquareTempBuffer, 0, sizeof (s->SquareTempBuffer));
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+	{
+		const plyVoiceTemp_t *ch = &song->pvt[i];
+		if (ch->audioSource != ch->SquareTempBuffer && !isSquareImage(ctx, ch->audioSource))
+			continue;
+
+		const int32_t offset = (int32_t)(ch->SquareTempBuffer - buffers->SquareTempBuffer[0]);
+		memcpy(&s->SquareTempBuffer[0][0] + offset, ch->audioSource, 4 << ch->Wavelength);
+		s->audioSourceOffset[i] = wavesOffset(ctx, ch->SquareTempBuffer);
+	}
+
+	/* Likewise, a voice that Paula plays a waveform image for (see SetAudio()) is saved
+	** as playing its voice buffer with the image copied in.
+	*/
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+	{
+		const paulaVoice_t *v = &ctx->paula.voice[i];
+		const int8_t *audioPointer = song->pvt[i].audioPointer;
+		if (!v->DMA_active || audioPointer == NULL || v->AUD_LC == audioPointer)
+			continue;
+
+		const int32_t offset = (int32_t)(audioPointer - buffers->currentVoice[0]);
+		memcpy(&s->currentVoice[0][0] + offset, v->AUD_LC, 0x280);
+		s->paula.AUD_LCOffset[i] = (uint32_t)(audioPointer - (const int8_t *)buffers);
+		s->paula.locationOffset[i] = s->paula.AUD_LCOffset[i] + (uint32_t)(v->location - v->AUD_LC);
+	}
+}
+
+// only call this while the mixer is locked. Nothing is changed if the state doesn't fit (ERR_BAD_STATE)
+static bool loadState(ahx_context_t *ctx, const ahxState_t *s)
+{
+	song_t *song = &ctx->song;
+	voiceBuffers_t *buffers = ctx->buffers;
+	paula_t *p = &ctx->paula;
+
+	bool ok = s->magic == AHX_STATE_MAGIC && s->version == AHX_STATE_VERSION && s->size == sizeof (ahxState_t) &&
+		s->outputFreq == p->audio.outputFreq && s->songHash == hashSong(song);
+
+	// a state can come from a file, the fields the replayer indexes its tables with are checked too
+	if (s->PosNr >= song->LenNr || s->NoteNr > 63 || s->PosJumpNote > 63)
+		ok = false;
+
+	// resolve all pointers before anything is changed
+	const int8_t *squareWave = wavesPointer(ctx, s->squareWaveOffset, 0, &ok); // set again before it's read
+	instrument_t *instrument[AMIGA_VOICES];
+	uint8_t *perfList[AMIGA_VOICES];
+	int8_t *audioPointer[AMIGA_VOICES], *squareTempBuffer[AMIGA_VOICES];
+	const int8_t *audioSource[AMIGA_VOICES];
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+	{
+		const plyVoiceTemp_t *ch = &s->pvt[i];
+		if (ch->Waveform > 4-1 || ch->Wavelength > 5 || !IN_RANGE(ch->TrackPeriod, 0, 5*12) || ch->vibratoCurrent > 63)
+		{
+			ok = false;
+			break;
+		}
+
+		// what SetAudio() reads of a new waveform (see CopyWaveformToPaulaBuffer() and getImage())
+		const uint32_t waveBytes = !ch->NewWaveform ? 0 : (ch->Waveform == 4-1) ? 0x280 : (4 << ch->Wavelength);
+
+		instrument[i] = (instrument_t *)instrumentPointer(song, s->instrumentRef[i], &ok);
+		perfList[i] = instrumentPointer(song, s->perfListRef[i], &ok);
+		audioPointer[i] = buffersPointer(ctx, s->audioPointerOffset[i], 0, &ok);
+		audioSource[i] = wavesPointer(ctx, s->audioSourceOffset[i], waveBytes, &ok);
+		squareTempBuffer[i] = buffersPointer(ctx, s->squareTempBufferOffset[i], 0, &ok);
+
+		// the replayer writes whole voice buffers and squares to these
+		if ((audioPointer[i] != NULL && audioPointer[i] != buffers->currentVoice[i]) ||
+			(squareTempBuffer[i] != NULL && squareTempBuffer[i] != buffers->SquareTempBuffer[i]))
+			ok = false;
+	}
+
+	if (!ok || !paulaLoadState(p, (const int8_t *)buffers, sizeof (voiceBuffers_t), &s->paula))
+	{
+		ctx->errCode = ERR_BAD_STATE;
+		return false;
+	}
+
+	song->intPlaying = s->intPlaying;
+	song->GetNewPosition = s->GetNewPosition;
+	song->PatternBreak = s->PatternBreak;
+	song->Subsong = s->Subsong;
+	song->Tempo = s->Tempo;
+	song->SongCIAPeriod = s->SongCIAPeriod;
+	song->StepWaitFrames = s->StepWaitFrames;
+	song->PosJump = s->PosJump;
+	song->PosJumpNote = s->PosJumpNote;
+	song->NoteNr = s->NoteNr;
+	song->PosNr = s->PosNr;
+	song->WNRandom = s->WNRandom;
+	song->tickCounter = s->tickCounter;
+	song->WaveformTab[2] = squareWave;
+	song->loopCounter = s->loopCounter;
+	song->loopTimes = s->loopTimes;
+	song->loopDetect = s->loopDetect;
+	song->dBPM = s->dBPM;
+
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+	{
+		plyVoiceTemp_t *ch = &song->pvt[i];
+
+		*ch = s->pvt[i];
+		ch->Instrument = instrument[i];
+		ch->InstrumentData = (instrument[i] != NULL) ? getInstrumentData(song, s->instrumentRef[i] >> 16) : NULL;
+		ch->perfList = perfList[i];
+		ch->audioPointer = audioPointer[i];
+		ch->audioSource = audioSource[i];
+		ch->SquareTempBuffer = squareTempBuffer[i];
+	}
+
+	memcpy(buffers->SquareTempBuffer, s->SquareTempBuffer, sizeof (buffers->SquareTempBuffer));
+	memcpy(buffers->currentVoice, s->currentVoice, sizeof (buffers->currentVoice));
+
+	ctx->tracePlayer.trace = NULL;
+	paulaDiscardTickWrites(p); // they were made from the old state
+	return true;
+}
+
+uint32_t ahxGetStateSize(void)
+{
+	return sizeof (ahxState_t);
+}
+
+bool ahxSaveStateCtx(ahx_context_t *ctx, void *state, uint32_t stateSize)
+{
+	ctx->errCode = ERR_SUCCESS;
+	if (!ctx->song.songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	if (state == NULL || stateSize < sizeof (ahxState_t))
+	{
+		ctx->errCode = ERR_BAD_STATE;
+		return false;
+	}
+
+	ahxState_t *s = (ahxState_t *)malloc(sizeof (ahxState_t)); // the caller's buffer doesn't have to be aligned
+	lookaheadState_t *current = (ctx->lookaheadStates != NULL) ? (lookaheadState_t *)malloc(sizeof (lookaheadState_t)) : NULL;
+	if (s == NULL || (ctx->lookaheadStates != NULL && current == NULL))
+	{
+		if (s != NULL)
+			free(s);
+
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	paulaLockMixer(&ctx->paula);
+
+	// in lookahead mode, the song state is saved as it was at the tick Paula is at (see syncLookahead())
+	const lookaheadState_t *l = queuedTickState(ctx);
+	if (l != NULL)
+	{
+		saveLookaheadState(ctx, current);
+		loadLookaheadState(ctx, l);
+		saveState(ctx, s);
+		loadLookaheadState(ctx, current);
+	}
+	else
+	{
+		saveState(ctx, s);
+	}
+
+	paulaUnlockMixer(&ctx->paula);
+
+	memcpy(state, s, sizeof (ahxState_t));
+	free(s);
+
+	if (current != NULL)
+		free(current);
+
+	return true;
+}
+
+bool ahxLoadStateCtx(ahx_context_t *ctx, const void *state, uint32_t stateSize)
+{
+	ctx->errCode = ERR_SUCCESS;
+	if (!ctx->song.songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	if (state == NULL || stateSize < sizeof (ahxState_t))
+	{
+		ctx->errCode = ERR_BAD_STATE;
+		return false;
+	}
+
+	ahxState_t *s = (ahxState_t *)malloc(sizeof (ahxState_t));
+	if (s == NULL)
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	memcpy(s, state, sizeof (ahxState_t));
+
+	paulaLockMixer(&ctx->paula);
+	const bool result = loadState(ctx, s);
+	paulaUnlockMixer(&ctx->paula);
+
+	free(s);
+	return result;
+}
+
+uint64_t ahxGetSongHashCtx(ahx_context_t *ctx)
+{
+	if (!ctx->song.songLoaded)
+		return 0;
+
+	return hashSong(&ctx->song);
+}
+
+/* Seek index: player state keyframes at fixed intervals of a sub-song's render, taken
+** during one pass over it. A seek loads the keyframe before the target and mixes (and
+** throws away) the rest, so it never costs more than mixing one keyframe interval.
+** The index is one block of memory, and is stored as-is in files.
+*/
+#define AHX_SEEK_INDEX_MAGIC 0x58494853 /* "SHIX" */
+#define SEEK_MIX_CHUNK 1024
+
+struct ahxSeekIndex_t
+{
+	uint32_t magic, stateSize, numKeyframes;
+	int32_t outputFreq;
+	uint64_t songHash;
+	uint64_t numSamples; // length of the indexed render (see ahxGetSongDuration())
+	uint64_t keyframeInterval; // in output samples
+	uint64_t keyframesHash; // catches damaged files (see ahxLoadSeekIndex())
+	ahxState_t keyframes[]; // keyframe n is at output sample n*keyframeInterval
+};
+
+static size_t seekIndexBytes(uint32_t numKeyframes)
+{
+	return sizeof (ahxSeekIndex_t) + (numKeyframes * sizeof (ahxState_t));
+}
+
+static uint64_t hashKeyframes(const ahxSeekIndex_t *index)
+{
+	return hashBytes(0xCBF29CE484222325ULL, index->keyframes, index->numKeyframes * sizeof (ahxState_t));
+}
+
+/* Mixes numSamples output samples to nowhere. Only call this while the mixer is locked,
+** and with no lookahead ticks queued (see syncLookahead()): the replayer thread can't make
+** any while the mixer is locked, so the mixer runs the replayer itself meanwhile.
+*/
+static void skipOutputSamples(ahx_context_t *ctx, uint64_t numSamples)
+{
+	int16_t buffer[SEEK_MIX_CHUNK * 2];
+
+	const bool pause = ctx->paula.audio.pause;
+	ctx->paula.audio.pause = false;
+
+	paulaTickWrites_t *tickQueue = ctx->paula.tickQueue;
+	ctx->paula.tickQueue = NULL;
+
+	while (numSamples > 0)
+	{
+		const int32_t samplesToMix = (numSamples > SEEK_MIX_CHUNK) ? SEEK_MIX_CHUNK : (int32_t)numSamples;
+		paulaOutputSamplesCtx(ctx, buffer, samplesToMix);
+		numSamples -= samplesToMix;
+	}
+
+	ctx->paula.tickQueue = tickQueue;
+	ctx->paula.audio.pause = pause;
+}
+
+ahxSeekIndex_t *ahxCreateSeekIndexCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t keyframeSeconds)
+{
+	paula_t *p = &ctx->paula;
+	songDuration_t duration;
+
+	if (!ahxGetSongDurationCtx(ctx, subSong, songLoopTimes, p->audio.outputFreq, &duration)) // modifies error code
+		return NULL;
+
+	if (keyframeSeconds < 1)
+		keyframeSeconds = 1;
+
+	const uint64_t keyframeInterval = (uint64_t)p->audio.outputFreq * keyframeSeconds;
+	const uint32_t numKeyframes = (uint32_t)(duration.numSamples / keyframeInterval) + 1;
+
+	ahxSeekIndex_t *index = (ahxSeekIndex_t *)malloc(seekIndexBytes(numKeyframes));
+	if (index == NULL)
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	index->magic = AHX_SEEK_INDEX_MAGIC;
+	index->stateSize = sizeof (ahxState_t);
+	index->numKeyframes = numKeyframes;
+	index->outputFreq = p->audio.outputFreq;
+	index->songHash = hashSong(&ctx->song);
+	index->numSamples = duration.numSamples;
+	index->keyframeInterval = keyframeInterval;
+
+	ahxPlayCtx(ctx, subSong);
+
+	paulaLockMixer(p);
+	syncLookahead(ctx); // the replayer thread can have run ahead since ahxPlayCtx()
+	for (uint32_t i = 0; i < numKeyframes; i++)
+	{
+		if (i > 0)
+			skipOutputSamples(ctx, keyframeInterval);
+
+		saveState(ctx, &index->keyframes[i]);
+	}
+	index->keyframesHash = hashKeyframes(index);
+
+	loadState(ctx, &index->keyframes[0]); // back to the start, as after ahxPlay()
+	paulaUnlockMixer(p);
+
+	return index;
+}
+
+void ahxFreeSeekIndex(ahxSeekIndex_t *index)
+{
+	if (index != NULL)
+		free(index);
+}
+
+uint64_t ahxGetSeekIndexLength(const ahxSeekIndex_t *index)
+{
+	return index->numSamples;
+}
+
+bool ahxSaveSeekIndex(const ahxSeekIndex_t *index, const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	const size_t bytes = seekIndexBytes(index->numKeyframes);
+	const bool result = fwrite(index, 1, bytes, f) == bytes;
+
+	fclose(f);
+	return result;
+}
+
+ahxSeekIndex_t *ahxLoadSeekIndex(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	ahxSeekIndex_t header;
+	if (fread(&header, 1, sizeof (header), f) != sizeof (header) || header.magic != AHX_SEEK_INDEX_MAGIC ||
+		header.stateSize != sizeof (ahxState_t) || header.numKeyframes == 0 || header.numKeyframes > AHX_RENDER_MAX_TICKS)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	// the header has to describe the index ahxCreateSeekIndexCtx() would have made, and the file has to hold all of it
+	const bool headerOK = header.outputFreq >= PAULA_MIN_FREQ && header.outputFreq <= PAULA_MAX_FREQ &&
+		header.keyframeInterval != 0 && (header.keyframeInterval % (uint64_t)header.outputFreq) == 0 &&
+		header.numKeyframes == (header.numSamples / header.keyframeInterval) + 1;
+
+	const uint64_t fileBytes = sizeof (ahxSeekIndex_t) + ((uint64_t)header.numKeyframes * sizeof (ahxState_t));
+	fseek(f, 0, SEEK_END);
+	if (!headerOK || (uint64_t)ftell(f) != fileBytes)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	fseek(f, sizeof (header), SEEK_SET);
+
+	ahxSeekIndex_t *index = (ahxSeekIndex_t *)malloc(seekIndexBytes(header.numKeyframes));
+	if (index == NULL)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	*index = header;
+
+	const size_t keyframeBytes = header.numKeyframes * sizeof (ahxState_t);
+	bool ok = fread(index->keyframes, 1, keyframeBytes, f) == keyframeBytes && hashKeyframes(index) == header.keyframesHash;
+
+	/* The keyframes have to belong to the header. What's in them is only checked by
+	** loadState() when they're seeked to (that needs the song), but a file that was
+	** damaged after it was saved doesn't get that far because of the hash.
+	*/
+	for (uint32_t i = 0; ok && i < header.numKeyframes; i++)
+	{
+		const ahxState_t *s = &index->keyframes[i];
+		ok = s->magic == AHX_STATE_MAGIC && s->version == AHX_STATE_VERSION && s->size == sizeof (ahxState_t) &&
+			s->outputFreq == header.outputFreq && s->songHash == header.songHash;
+	}
+
+	if (!ok)
+	{
+		free(index);
+		index = NULL;
+	}
+
+	fclose(f);
+	return index;
+}
+
+bool ahxSeekCtx(ahx_context_t *ctx, const ahxSeekIndex_t *index, uint64_t sampleOffset)
+{
+	paula_t *p = &ctx->paula;
+
+	ctx->errCode = ERR_SUCCESS;
+	if (!ctx->song.songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	uint64_t keyframe = sampleOffset / index->keyframeInterval;
+	if (keyframe >= index->numKeyframes)
+		keyframe = index->numKeyframes - 1;
+
+	paulaLockMixer(p);
+
+	const bool result = loadState(ctx, &index->keyframes[keyframe]); // ERR_BAD_STATE if it's for another song or output rate
+	if (result)
+		skipOutputSamples(ctx, sampleOffset - (keyframe * index->keyframeInterval));
+
+	paulaUnlockMixer(p);
+
+	return result;
+}
+
+/* Fast-forward seeking. The skipped ticks run the replayer (and so the Paula register
+** writes), but not the mixer: the voices are advanced with paulaSkipSamples() instead.
+** That lands the replayer, the voices' phase/DMA and the dither generator exactly where
+** a full render would be, but not the pending BLEPs and the high-pass filter, as those
+** depend on the audio. So the last SEEK_PREROLL_SECONDS are mixed (to nowhere), by then
+** the filter has converged towards where it would be. Converged, not bit-identical: the
+** landing state can still differ in its last bits, and that can (rarely) flip an output
+** sample by one LSB until the difference dies out.
+*/
+#define SEEK_PREROLL_SECONDS 3
+
+static uint32_t prerollTicks(const song_t *s)
+{
+	return (uint32_t)ceil(SEEK_PREROLL_SECONDS * amigaCIAPeriod2Hz(s->SongCIAPeriod));
+}
+
+// the samples left of the current replayer tick (0 if the next one is due)
+static int32_t samplesLeftOfTick(const paula_t *p)
+{
+	if (p->audio.tickSampleCounter64 <= 0)
+		return 0;
+
+	return (int32_t)((p->audio.tickSampleCounter64 + UINT32_MAX) >> 32); // ceil (rounded upwards)
+}
+
+// runs numTicks replayer ticks without mixing (see above). Only call this while the mixer is locked
+static void skipTicks(ahx_context_t *ctx, uint32_t numTicks)
+{
+	paula_t *p = &ctx->paula;
+
+	for (uint32_t i = 0; i < numTicks; i++)
+	{
+		SIDInterruptCtx(ctx);
+		p->audio.tickSampleCounter64 += p->audio.samplesPerTick64;
+
+		const int32_t samplesInTick = samplesLeftOfTick(p);
+		paulaSkipSamples(p, samplesInTick);
+		p->audio.tickSampleCounter64 -= (int64_t)samplesInTick << 32;
+	}
+}
+
+// the same with mixing, only call this while the mixer is locked
+static void mixTicks(ahx_context_t *ctx, uint32_t numTicks)
+{
+	paula_t *p = &ctx->paula;
+
+	for (uint32_t i = 0; i < numTicks; i++)
+		skipOutputSamples(ctx, (p->audio.tickSampleCounter64 + p->audio.samplesPerTick64 + UINT32_MAX) >> 32);
+}
+
+bool ahxSeekTicksCtx(ahx_context_t *ctx, uint32_t numTicks)
+{
+	paula_t *p = &ctx->paula;
+
+	ctx->errCode = ERR_SUCCESS;
+	if (!ctx->song.songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	paulaLockMixer(p);
+	syncLookahead(ctx); // from the tick that's heard
+
+	// the rest of the current tick comes first
+	const int32_t samplesLeft = samplesLeftOfTick(p);
+	const uint32_t preroll = prerollTicks(&ctx->song);
+	if (numTicks > preroll)
+	{
+		paulaSkipSamples(p, samplesLeft);
+		p->audio.tickSampleCounter64 -= (int64_t)samplesLeft << 32;
+
+		skipTicks(ctx, numTicks - preroll);
+		mixTicks(ctx, preroll);
+	}
+	else
+	{
+		skipOutputSamples(ctx, samplesLeft);
+		mixTicks(ctx, numTicks);
+	}
+
+	paulaUnlockMixer(p);
+	return true;
+}
+
+// replayer only, returns false if the song loops or ends before it gets to the row
+static bool findRow(ahx_context_t *ctx, uint16_t posNr, uint16_t noteNr, uint32_t *numTicks)
+{
+	song_t *song = &ctx->song;
+
+	song->loopTimes = 1; // loops are counted in loopCounter from now on (see SIDInterruptCtx())
+	for (uint32_t tick = 0; tick < AHX_RENDER_MAX_TICKS; tick++)
+	{
+		if (!song->intPlaying || song->loopCounter != 0)
+			break;
+
+		if (song->StepWaitFrames == 0 && song->PosNr == posNr && song->NoteNr == noteNr) // the row is next
+		{
+			*numTicks = tick;
+			return true;
+		}
+
+		SIDInterruptCtx(ctx);
+	}
+
+	return false;
+}
+
+bool ahxSeekToPositionCtx(ahx_context_t *ctx, int32_t posNr, int32_t noteNr)
+{
+	song_t *song = &ctx->song;
+
+	ctx->errCode = ERR_SUCCESS;
+	if (!song->songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	if (posNr < 0 || posNr >= song->LenNr || noteNr < 0 || noteNr >= song->TrackLength)
+	{
+		ctx->errCode = ERR_BAD_POSITION;
+		return false;
+	}
+
+	const int32_t subSong = song->Subsong;
+	if (!ahxPlayCtx(ctx, subSong)) // modifies error code
+		return false;
+
+	// the search runs the replayer from the start of the sub-song, which is restored afterwards
+	ahxState_t *start = (ahxState_t *)malloc(sizeof (ahxState_t));
+	if (start == NULL)
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	uint32_t numTicks = 0;
+
+	paulaLockMixer(&ctx->paula);
+	syncLookahead(ctx); // the replayer thread can have run ahead since ahxPlayCtx()
+	saveState(ctx, start);
+	const bool found = findRow(ctx, (uint16_t)posNr, (uint16_t)noteNr, &numTicks);
+	loadState(ctx, start);
+	paulaUnlockMixer(&ctx->paula);
+
+	free(start);
+	if (!found)
+		return false;
+
+	return ahxSeekTicksCtx(ctx, numTicks);
+}
+
+/* Parallel WAV rendering. The chunks start on replayer tick boundaries. Every chunk is
+** mixed from a checkpoint SEEK_PREROLL_SECONDS before it, which the sequential pass got
+** by fast-forwarding (like ahxSeekTicksCtx()), so the chunk starts out exact once the
+** pre-roll is mixed. As the filter state can still be a bit off at that point (see above),
+** ahxFinishRenderJobCtx() checks every seam by comparing the state a chunk started with to
+** the state the chunk before it ended with, and renders the (rare) mismatching chunks again
+** from there.
+*/
+typedef struct renderChunk_t
+{
+	uint32_t startTick, numTicks, prerollTicks;
+	uint64_t startSample, numSamples;
+	bool rendered;
+	ahxState_t checkpoint; // prerollTicks before startTick
+	ahxState_t startState, endState; // after the pre-roll, and at the end of the chunk
+} renderChunk_t;
+
+struct ahxRenderJob_t
+{
+	// the mixer settings the chunks have to be rendered with
+	int32_t outputFreq, masterVol, stereoSeparation, quality, engine;
+	bool channelBLEP, polyphaseBLEP;
+
+	uint64_t numSamples; // length of the render (see ahxGetSongDuration())
+	int16_t *output; // numSamples stereo samples
+	int32_t numChunks;
+	renderChunk_t chunks[];
+};
+
+static bool hasRenderJobSettings(const ahx_context_t *ctx, const ahxRenderJob_t *job)
+{
+	const paula_t *p = &ctx->paula;
+
+	return p->audio.outputFreq == job->outputFreq && p->audio.masterVol == job->masterVol &&
+		p->audio.stereoSeparation == job->stereoSeparation && p->quality == job->quality &&
+		p->engine == job->engine && p->channelBLEP == job->channelBLEP && p->usePolyphaseBLEP == job->polyphaseBLEP;
+}
+
+// mixes numTicks whole replayer ticks into out, like recordWAV(). Only call this while the mixer is locked
+static void renderTicks(ahx_context_t *ctx, int16_t *out, uint32_t numTicks)
+{
+	for (uint32_t i = 0; i < numTicks; i++)
+		out += ahxGetFrame(ctx, out) / sizeof (int16_t);
+}
+
+ahxRenderJob_t *ahxCreateRenderJobCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t numChunks)
+{
+	song_t *song = &ctx->song;
+	paula_t *p = &ctx->paula;
+	songDuration_t duration;
+
+	if (!ahxGetSongDurationCtx(ctx, subSong, songLoopTimes, p->audio.outputFreq, &duration)) // modifies error code
+		return NULL;
+
+	if ((uint32_t)numChunks > duration.numTicks)
+		numChunks = (int32_t)duration.numTicks;
+
+	if (numChunks < 1)
+		numChunks = 1;
+
+	ahxRenderJob_t *job = (ahxRenderJob_t *)malloc(sizeof (ahxRenderJob_t) + (numChunks * sizeof (renderChunk_t)));
+	if (job == NULL)
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	job->output = (int16_t *)malloc((size_t)duration.numSamples * (2 * sizeof (int16_t)));
+	if (job->output == NULL && duration.numSamples > 0)
+	{
+		free(job);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	job->outputFreq = p->audio.outputFreq;
+	job->masterVol = p->audio.masterVol;
+	job->stereoSeparation = p->audio.stereoSeparation;
+	job->quality = p->quality;
+	job->engine = p->engine;
+	job->channelBLEP = p->channelBLEP;
+	job->polyphaseBLEP = p->usePolyphaseBLEP;
+	job->numSamples = duration.numSamples;
+	job->numChunks = numChunks;
+
+	ahxPlayCtx(ctx, subSong);
+
+	paulaLockMixer(p);
+	syncLookahead(ctx); // the replayer thread can have run ahead since ahxPlayCtx()
+
+	ctx->isRecordingToWAV = true; // cleared by the replayer when the song ends (see SIDInterruptCtx())
+	song->loopTimes = songLoopTimes;
+
+	const uint32_t preroll = prerollTicks(song);
+
+	uint32_t tick = 0;
+	for (int32_t i = 0; i < numChunks; i++)
+	{
+		renderChunk_t *c = &job->chunks[i];
+
+		c->startTick = (uint32_t)(((uint64_t)duration.numTicks * i) / numChunks);
+		c->numTicks = (uint32_t)(((uint64_t)duration.numTicks * (i+1)) / numChunks) - c->startTick;
+		c->prerollTicks = (c->startTick < preroll) ? c->startTick : preroll;
+		c->startSample = ticksToSamples(p->audio.samplesPerTick64, c->startTick);
+		c->numSamples = ticksToSamples(p->audio.samplesPerTick64, c->startTick + c->numTicks) - c->startSample;
+		c->rendered = false;
+
+		const uint32_t checkpointTick = c->startTick - c->prerollTicks;
+		skipTicks(ctx, checkpointTick - tick);
+		tick = checkpointTick;
+
+		saveState(ctx, &c->checkpoint);
+	}
+
+	ctx->isRecordingToWAV = false;
+
+	paulaUnlockMixer(p);
+
+	ahxStopCtx(ctx);
+	return job;
+}
+
+bool ahxRenderJobChunkCtx(ahx_context_t *ctx, ahxRenderJob_t *job, int32_t chunk)
+{
+	paula_t *p = &ctx->paula;
+
+	ctx->errCode = ERR_SUCCESS;
+	if (!ctx->song.songLoaded)
+	{
+		ctx->errCode = ERR_SONG_NOT_LOADED;
+		return false;
+	}
+
+	if (chunk < 0 || chunk >= job->numChunks || !hasRenderJobSettings(ctx, job))
+	{
+		ctx->errCode = ERR_BAD_STATE;
+		return false;
+	}
+
+	renderChunk_t *c = &job->chunks[chunk];
+
+	paulaLockMixer(p);
+
+	if (!loadState(ctx, &c->checkpoint)) // a different song
+	{
+		paulaUnlockMixer(p);
+		return false;
+	}
+
+	mixTicks(ctx, c->prerollTicks);
+	saveState(ctx, &c->startState);
+
+	renderTicks(ctx, job->output + (c->startSample * 2), c->numTicks);
+	saveState(ctx, &c->endState);
+
+	c->rendered = true;
+
+	paulaUnlockMixer(p);
+	return true;
+}
+
+bool ahxFinishRenderJobCtx(ahx_context_t *ctx, ahxRenderJob_t *job)
+{
+	paula_t *p = &ctx->paula;
+
+	for (int32_t i = 0; i < job->numChunks; i++)
+	{
+		if (!job->chunks[i].rendered && !ahxRenderJobChunkCtx(ctx, job, i)) // modifies error code
+			return false;
+	}
+
+	// continue every chunk that didn't start where the one before it ended from there instead
+	paulaLockMixer(p);
+	for (int32_t i = 1; i < job->numChunks; i++)
+	{
+		const renderChunk_t *prev = &job->chunks[i-1];
+		renderChunk_t *c = &job->chunks[i];
+
+		if (memcmp(&c->startState, &prev->endState, sizeof (ahxState_t)) == 0)
+			continue;
+
+		loadState(ctx, &prev->endState);
+		c->startState = prev->endState;
+
+		renderTicks(ctx, job->output + (c->startSample * 2), c->numTicks);
+		saveState(ctx, &c->endState);
+	}
+	paulaUnlockMixer(p);
+
+	ahxStopCtx(ctx);
+	return true;
+}
+
+void ahxFreeRenderJob(ahxRenderJob_t *job)
+{
+	if (job != NULL)
+	{
+		if (job->output != NULL)
+			free(job->output);
+
+		free(job);
+	}
+}
+
+int32_t ahxGetRenderJobChunks(const ahxRenderJob_t *job)
+{
+	return job->numChunks;
+}
+
+const int16_t *ahxGetRenderJobOutput(const ahxRenderJob_t *job, uint64_t *numSamples)
+{
+	if (numSamples != NULL)
+		*numSamples = job->numSamples;
+
+	return job->output;
+}
+
+bool ahxSaveRenderJobWAV(const ahxRenderJob_t *job, const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	writeWAVHeader(f, job->outputFreq);
+
+	const size_t numBytes = (size_t)job->numSamples * (2 * sizeof (int16_t));
+	const bool result = fwrite(job->output, 1, numBytes, f) == numBytes;
+
+	finishWAVHeader(f, (uint32_t)numBytes);
+
+	fclose(f);
+	return result;
+}
+
+typedef struct
+{
+	ahxTrace_t *trace; // grows while it's written
+	uint32_t capacity; // bytes of trace data there's room for
+	bool outOfMemory;
+} traceWriter_t;
+
+typedef struct // what a voice's writes of a tick are stored as
+{
+	uint8_t code; // TRACE_xxx, 0 = nothing changed
+	uint32_t tableOffset, spanStart, spanLength;
+} traceVoiceWrites_t;
+
+static void traceWriteBytes(traceWriter_t *tw, const void *src, uint32_t numBytes)
+{
+	if (tw->outOfMemory)
+		return;
+
+	ahxTrace_t *trace = tw->trace;
+	if (trace->dataSize+numBytes > tw->capacity)
+	{
+		uint32_t capacity = tw->capacity * 2;
+		while (trace->dataSize+numBytes > capacity)
+			capacity *= 2;
+
+		trace = (ahxTrace_t *)realloc(trace, sizeof (ahxTrace_t) + capacity);
+		if (trace == NULL)
+		{
+			tw->outOfMemory = true;
+			return;
+		}
+
+		tw->trace = trace;
+		tw->capacity = capacity;
+	}
+
+	memcpy(&trace->data[trace->dataSize], src, numBytes);
+	trace->dataSize += numBytes;
+}
+
+static void traceWriteByte(traceWriter_t *tw, uint8_t x)
+{
+	traceWriteBytes(tw, &x, 1);
+}
+
+static void traceWriteVarint(traceWriter_t *tw, uint32_t x)
+{
+	uint8_t bytes[5];
+
+	int32_t numBytes = 0;
+	for (; x >= 0x80; x >>= 7)
+		bytes[numBytes++] = (uint8_t)x | 0x80;
+	bytes[numBytes++] = (uint8_t)x;
+
+	traceWriteBytes(tw, bytes, numBytes);
+}
+
+static uint8_t paulaVolume(uint16_t vol) // the volume Paula sets for this (see paulaSetVolume())
+{
+	vol &= 127;
+	return (vol > 64) ? 64 : (uint8_t)vol;
+}
+
+static int32_t shortestCycle(const int8_t *buffer) // cycle code (see traceCycleLength()) of the shortest cycle the buffer repeats
+{
+	for (int32_t cycleCode = 0; cycleCode < 6; cycleCode++)
+	{
+		const int32_t cycleLength = traceCycleLength(cycleCode);
+		if (memcmp(buffer, &buffer[cycleLength], PAULA_VOICE_BUFFER_SIZE-cycleLength) == 0)
+			return cycleCode;
+	}
+
+	return 6;
+}
+
+static const int8_t *writtenData(const paulaTickWrites_t *w, int32_t ch) // the voice buffer contents of a PAULA_WRITE_DATA
+{
+	return (w->dataTarget[ch] != NULL) ? w->data[ch] : w->dataImage[ch];
+}
+
+/* Finds out what of a voice's writes in w change anything, and how to store them.
+** audioSource is where the replayer copied the voice buffer contents from (if it did),
+** it's only used if it's in the waveform tables and has the same bytes.
+*/
+static void traceVoiceWrites(const ahx_context_t *ctx, const paulaTickWrites_t *w, int32_t ch,
+	const int8_t *audioSource, const traceVoices_t *tv, traceVoiceWrites_t *vw)
+{
+	vw->code = 0;
+
+	if ((w->flags[ch] & PAULA_WRITE_PERIOD) && w->period[ch] != tv->period[ch])
+		vw->code |= TRACE_PERIOD;
+
+	if ((w->flags[ch] & PAULA_WRITE_DATA) && memcmp(writtenData(w, ch), tv->voiceBuffer[ch], PAULA_VOICE_BUFFER_SIZE) != 0)
+	{
+		const int8_t *data = writtenData(w, ch);
+		const int32_t cycleCode = shortestCycle(data);
+		const int32_t cycleLength = traceCycleLength(cycleCode);
+
+		vw->code |= TRACE_DATA | (cycleCode << TRACE_CYCLE_SHIFT);
+
+		const uintptr_t tables = (uintptr_t)ctx->waves, source = (uintptr_t)audioSource;
+		if (source >= tables && source+cycleLength <= tables+sizeof (waveforms_t) && memcmp(audioSource, data, cycleLength) == 0)
+		{
+			vw->code |= TRACE_DATA_FROM_WAVES;
+			vw->tableOffset = (uint32_t)(source - tables);
+		}
+		else
+		{
+			const int8_t *old = tv->voiceBuffer[ch];
+
+			int32_t start = 0, end = cycleLength;
+			while (start < end && data[start] == old[start])
+				start++;
+
+			while (end > start && data[end-1] == old[end-1])
+				end--;
+
+			vw->spanStart = start;
+			vw->spanLength = end - start;
+		}
+	}
+
+	if ((w->flags[ch] & PAULA_WRITE_VOLUME) && paulaVolume(w->volume[ch]) != tv->volume[ch])
+		vw->code |= TRACE_VOLUME;
+}
+
+// stores a voice's writes (see traceReadVoice()), and updates tv
+static void traceWriteVoice(traceWriter_t *tw, const paulaTickWrites_t *w, int32_t ch, const traceVoiceWrites_t *vw, traceVoices_t *tv)
+{
+	traceWriteByte(tw, vw->code);
+
+	if (vw->code & TRACE_PERIOD)
+	{
+		const int32_t delta = (int16_t)(w->period[ch] - tv->period[ch]);
+		traceWriteVarint(tw, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31)); // zigzag
+		tv->period[ch] = w->period[ch];
+	}
+
+	if (vw->code & TRACE_DATA)
+	{
+		if (vw->code & TRACE_DATA_FROM_WAVES)
+		{
+			traceWriteVarint(tw, vw->tableOffset);
+		}
+		else
+		{
+			traceWriteVarint(tw, vw->spanStart);
+			traceWriteVarint(tw, vw->spanLength);
+			traceWriteBytes(tw, &writtenData(w, ch)[vw->spanStart], vw->spanLength);
+		}
+
+		memcpy(tv->voiceBuffer[ch], writtenData(w, ch), PAULA_VOICE_BUFFER_SIZE);
+	}
+
+	if (vw->code & TRACE_VOLUME)
+	{
+		tv->volume[ch] = paulaVolume(w->volume[ch]);
+		traceWriteByte(tw, tv->volume[ch]);
+	}
+}
+
+static void traceWriteEmptyTicks(traceWriter_t *tw, uint32_t numTicks)
+{
+	if (numTicks > 0)
+		traceWriteByte(tw, (uint8_t)(TRACE_EMPTY_TICKS | (numTicks-1)));
+}
+
+ahxTrace_t *ahxCreateTraceCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes)
+{
+	song_t *song = &ctx->song;
+	paula_t *p = &ctx->paula;
+
+	// the replayer counts the loops of a song stuck in a loop late, the dry run knows where they start (see detectStateLoop())
+	songDuration_t duration;
+	if (!ahxGetSongDurationCtx(ctx, subSong, songLoopTimes, p->audio.outputFreq, &duration)) // modifies error code
+		return NULL;
+
+	if (!ahxPlayCtx(ctx, subSong)) // modifies error code
+		return NULL;
+
+	traceWriter_t tw;
+	tw.capacity = 65536;
+	tw.outOfMemory = false;
+	tw.trace = (ahxTrace_t *)malloc(sizeof (ahxTrace_t) + tw.capacity);
+
+	traceVoices_t *tv = (traceVoices_t *)malloc(sizeof (traceVoices_t));
+	paulaTickWrites_t *w = (paulaTickWrites_t *)malloc(sizeof (paulaTickWrites_t));
+
+	if (tw.trace == NULL || tv == NULL || w == NULL)
+	{
+		if (tw.trace != NULL)
+			free(tw.trace);
+
+		if (tv != NULL)
+			free(tv);
+
+		if (w != NULL)
+			free(w);
+
+		ahxStopCtx(ctx);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	tw.trace->magic = AHX_TRACE_MAGIC;
+	tw.trace->version = AHX_TRACE_VERSION;
+	tw.trace->dataSize = 0;
+	tw.trace->ciaPeriod = song->SongCIAPeriod;
+	tw.trace->reserved = 0;
+
+	resetTraceVoices(tv);
+
+	paulaLockMixer(p);
+	syncLookahead(ctx); // the replayer thread can have run ahead since ahxPlayCtx()
+
+	ctx->isRecordingToWAV = true; // cleared by the replayer when the song ends (see SIDInterruptCtx())
+	song->loopTimes = songLoopTimes;
+
+	uint32_t numTicks = 0, emptyTicks = 0;
+	while (ctx->isRecordingToWAV && song->tickCounter < duration.numTicks && !tw.outOfMemory)
+	{
+		// the Paula writes of a tick are made first, from the voices' state before it
+		const int8_t *audioSource[AMIGA_VOICES];
+		for (int32_t i = 0; i < AMIGA_VOICES; i++)
+			audioSource[i] = song->pvt[i].audioSource;
+
+		memset(w->flags, 0, sizeof (w->flags));
+		replayerTick(ctx, w);
+		numTicks++;
+
+		traceVoiceWrites_t vw[AMIGA_VOICES];
+		uint8_t voiceMask = 0;
+		for (int32_t i = 0; i < AMIGA_VOICES; i++)
+		{
+			traceVoiceWrites(ctx, w, i, audioSource[i], tv, &vw[i]);
+			if (vw[i].code != 0)
+				voiceMask |= 1 << i;
+		}
+
+		if (voiceMask == 0)
+		{
+			if (++emptyTicks == TRACE_MAX_EMPTY_TICKS)
+			{
+				traceWriteEmptyTicks(&tw, emptyTicks);
+				emptyTicks = 0;
+			}
+
+			continue;
+		}
+
+		traceWriteEmptyTicks(&tw, emptyTicks);
+		emptyTicks = 0;
+
+		traceWriteByte(&tw, voiceMask);
+		for (int32_t i = 0; i < AMIGA_VOICES; i++)
+		{
+			if (voiceMask & (1 << i))
+				traceWriteVoice(&tw, w, i, &vw[i], tv);
+		}
+	}
+	traceWriteEmptyTicks(&tw, emptyTicks);
+
+	ctx->isRecordingToWAV = false;
+
+	paulaUnlockMixer(p);
+
+	free(tv);
+	free(w);
+	ahxStopCtx(ctx);
+
+	if (tw.outOfMemory)
+	{
+		free(tw.trace);
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	tw.trace->numTicks = numTicks;
+
+	ahxTrace_t *trace = (ahxTrace_t *)realloc(tw.trace, sizeof (ahxTrace_t) + tw.trace->dataSize); // give back the rest
+	return (trace != NULL) ? trace : tw.trace;
+}
+
+void ahxFreeTrace(ahxTrace_t *trace)
+{
+	if (trace != NULL)
+		free(trace);
+}
+
+uint32_t ahxGetTraceTicks(const ahxTrace_t *trace)
+{
+	return trace->numTicks;
+}
+
+uint32_t ahxGetTraceSize(const ahxTrace_t *trace)
+{
+	return sizeof (ahxTrace_t) + trace->dataSize;
+}
+
+bool ahxSaveTrace(const ahxTrace_t *trace, const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	const size_t bytes = ahxGetTraceSize(trace);
+	const bool result = fwrite(trace, 1, bytes, f) == bytes;
+
+	fclose(f);
+	return result;
+}
+
+static bool isTraceHeader(const ahxTrace_t *header)
+{
+	return header->magic == AHX_TRACE_MAGIC && header->version == AHX_TRACE_VERSION && header->numTicks <= AHX_RENDER_MAX_TICKS &&
+		header->ciaPeriod > 0 && header->ciaPeriod <= AHX_HIGHEST_CIA_PERIOD;
+}
+
+ahxTrace_t *ahxLoadTrace(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	ahxTrace_t header;
+	if (fread(&header, 1, sizeof (header), f) != sizeof (header) || !isTraceHeader(&header))
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	ahxTrace_t *trace = (ahxTrace_t *)malloc(sizeof (ahxTrace_t) + header.dataSize);
+	if (trace == NULL)
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	*trace = header;
+
+	if (fread(trace->data, 1, header.dataSize, f) != header.dataSize)
+	{
+		free(trace);
+		trace = NULL;
+	}
+
+	fclose(f);
+	return trace;
+}
+
+ahxTrace_t *ahxLoadTraceFromRAM(const uint8_t *data, uint32_t dataSize)
+{
+	ahxTrace_t header;
+	if (dataSize < sizeof (header))
+		return NULL;
+
+	memcpy(&header, data, sizeof (header));
+	if (!isTraceHeader(&header) || header.dataSize > dataSize-sizeof (header))
+		return NULL;
+
+	ahxTrace_t *trace = (ahxTrace_t *)malloc(sizeof (ahxTrace_t) + header.dataSize);
+	if (trace != NULL)
+		memcpy(trace, data, sizeof (ahxTrace_t) + header.dataSize);
+
+	return trace;
+}
+
+bool ahxPlayTraceCtx(ahx_context_t *ctx, const ahxTrace_t *trace)
+{
+	song_t *song = &ctx->song;
+	voiceBuffers_t *buffers = ctx->buffers;
+	paula_t *p = &ctx->paula;
+
+	ctx->errCode = ERR_SUCCESS;
+
+	if (buffers == NULL)
+	{
+		ctx->errCode = ERR_NO_WAVES;
+		return false;
+	}
+
+	paulaLockMixer(p);
+
+	// stop the song, if any, and set Paula up like ahxPlay() does
+	song->intPlaying = false;
+	ahxQuietAudios(ctx);
+
+	for (int32_t i = 0; i < AMIGA_VOICES; i++)
+		InitVoiceXTemp(&song->pvt[i]);
+
+	memset(buffers->currentVoice, 0, sizeof (buffers->currentVoice)); // as in a new context (the DMAs start with a fetch from these)
+	SetUpAudioChannels(ctx);
+	amigaSetCIAPeriod(p, trace->ciaPeriod);
+
+	tracePlayer_t *tp = &ctx->tracePlayer;
+	tp->trace = trace;
+	tp->offset = tp->tick = tp->emptyTicks = 0;
+	resetTraceVoices(&tp->voices);
+
+	p->audio.tickSampleCounter64 = 0; // the first tick is due right away
+
+	paulaClearFilterState(p);
+	resetCachedMixerPeriod(p);
+	resetAudioDithering(p);
+
+	paulaDiscardTickWrites(p);
+	paulaUnlockMixer(p);
+
+	return true;
+}
+
+bool ahxRecordTraceWAVCtx(ahx_context_t *ctx, const ahxTrace_t *trace, const char *fileOut)
+{
+	const int32_t audioFreq = ctx->paula.audio.outputFreq;
+	const int32_t maxSamplesPerTick = (int32_t)ceil(audioFreq / amigaCIAPeriod2Hz(AHX_HIGHEST_CIA_PERIOD));
+
+	ctx->errCode = ERR_SUCCESS;
+
+	int16_t *outputBuffer = (int16_t *)malloc(maxSamplesPerTick * (2 * sizeof (int16_t)));
+	if (outputBuffer == NULL)
+	{
+		ctx->errCode = ERR_OUT_OF_MEMORY;
+		return false;
+	}
+
+	FILE *f = fopen(fileOut, "wb");
+	if (f == NULL)
+	{
+		free(outputBuffer);
+		ctx->errCode = ERR_FILE_IO;
+		return false;
+	}
+
+	writeWAVHeader(f, audioFreq);
+
+	ctx->isRecordingToWAV = true;
+	if (!ahxPlayTraceCtx(ctx, trace)) // modifies error code
+	{
+		ctx->isRecordingToWAV = false;
+		fclose(f);
+		free(outputBuffer);
+		return false;
+	}
+
+	uint32_t totalBytes = 0;
+	while (ctx->isRecordingToWAV) // cleared on the trace's last tick
+	{
+		const int32_t bytesMixed = ahxGetFrame(ctx, outputBuffer);
+		fwrite(outputBuffer, 1, bytesMixed, f);
+		totalBytes += bytesMixed;
+	}
+
+	finishWAVHeader(f, totalBytes);
+	ahxStopCtx(ctx);
+
+	fclose(f);
+	free(outputBuffer);
+
+	return true;
+}
+
+const song_t *ahxGetSongCtx(ahx_context_t *ctx)
+{
+	return &ctx->song;
+}
+
+bool ahxIsRecordingWAVCtx(ahx_context_t *ctx)
+{
+	return ctx->isRecordingToWAV;
+}
+
+void ahxSetRecordingWAVCtx(ahx_context_t *ctx, bool recording)
+{
+	ctx->isRecordingToWAV = recording;
+}
+
+int32_t ahxGetErrorCodeCtx(ahx_context_t *ctx)
+{
+	return ctx->errCode;
+}
+
+void ahxSetWaveformCopyingCtx(ahx_context_t *ctx, bool copy)
+{
+	paulaLockMixer(&ctx->paula);
+	ctx->copyWaveforms = copy;
+	paulaUnlockMixer(&ctx->paula);
+}
+
+bool ahxGetSongDuration(int32_t subSong, int32_t songLoopTimes, int32_t audioFreq, songDuration_t *duration)
+{
+	return ahxGetSongDurationCtx(&ahxDefaultContext, subSong, songLoopTimes, audioFreq, duration);
+}
+
+bool ahxSaveState(void *state, uint32_t stateSize)
+{
+	return ahxSaveStateCtx(&ahxDefaultContext, state, stateSize);
+}
+
+bool ahxLoadState(const void *state, uint32_t stateSize)
+{
+	return ahxLoadStateCtx(&ahxDefaultContext, state, stateSize);
+}
+
+uint64_t ahxGetSongHash(void)
+{
+	return ahxGetSongHashCtx(&ahxDefaultContext);
+}
+
+ahxSeekIndex_t *ahxCreateSeekIndex(int32_t subSong, int32_t songLoopTimes, int32_t keyframeSeconds)
+{
+	return ahxCreateSeekIndexCtx(&ahxDefaultContext, subSong, songLoopTimes, keyframeSeconds);
+}
+
+bool ahxSeek(const ahxSeekIndex_t *index, uint64_t sampleOffset)
+{
+	return ahxSeekCtx(&ahxDefaultContext, index, sampleOffset);
+}
+
+bool ahxSeekTicks(uint32_t numTicks)
+{
+	return ahxSeekTicksCtx(&ahxDefaultContext, numTicks);
+}
+
+bool ahxSeekToPosition(int32_t posNr, int32_t noteNr)
+{
+	return ahxSeekToPositionCtx(&ahxDefaultContext, posNr, noteNr);
+}
+
+ahxRenderJob_t *ahxCreateRenderJob(int32_t subSong, int32_t songLoopTimes, int32_t numChunks)
+{
+	return ahxCreateRenderJobCtx(&ahxDefaultContext, subSong, songLoopTimes, numChunks);
+}
+
+bool ahxFinishRenderJob(ahxRenderJob_t *job)
+{
+	return ahxFinishRenderJobCtx(&ahxDefaultContext, job);
+}
+
+const song_t *ahxGetSong(void)
+{
+	return ahxGetSongCtx(&ahxDefaultContext);
+}
+
+bool ahxIsRecordingWAV(void)
+{
+	return ahxIsRecordingWAVCtx(&ahxDefaultContext);
+}
+
+void ahxSetRecordingWAV(bool recording)
+{
+	ahxSetRecordingWAVCtx(&ahxDefaultContext, recording);
+}
+
+int32_t ahxGetErrorCode(void)
+{
+	return ahxGetErrorCodeCtx(&ahxDefaultContext);
+}
+
+void ahxSetWaveformCopying(bool copy)
+{
+	ahxSetWaveformCopyingCtx(&ahxDefaultContext, copy);
+}
+
+ahxTrace_t *ahxCreateTrace(int32_t subSong, int32_t songLoopTimes)
+{
+	return ahxCreateTraceCtx(&ahxDefaultContext, subSong, songLoopTimes);
+}
+
+bool ahxPlayTrace(const ahxTrace_t *trace)
 {
-	return ahxErrCode;
+	return ahxPlayTraceCtx(&ahxDefaultContext, trace);
+}
+
+// masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
+bool ahxRecordTraceWAV(const ahxTrace_t *trace, const char *fileOut, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation)
+{
+	ahx_context_t *ctx = &ahxDefaultContext;
+
+	if (!initContext(ctx, audioFreq, masterVol, stereoSeparation, PAULA_QUALITY_BLEP)) // WAV rendering is always done at full quality
+		return false;
+
+	const bool result = ahxRecordTraceWAVCtx(ctx, trace, fileOut);
+
+	paulaClose(&ctx->paula);
+	ahxFreeWaves(ctx);
+
+	return result;
 }
@@ -12,17 +12,22 @@ enum
 	ERR_FILE_IO         = 3,
 	ERR_NOT_AN_AHX      = 4,
 	ERR_NO_WAVES        = 5,
-	ERR_SONG_NOT_LOADED = 6
+	ERR_SONG_NOT_LOADED = 6,
+	ERR_BAD_STATE       = 7,
+	ERR_BAD_POSITION    = 8
 };
 
 #define AHX_HIGHEST_CIA_PERIOD 14209 /* ~49.92Hz */
 #define AHX_DEFAULT_CIA_PERIOD AHX_HIGHEST_CIA_PERIOD
 
+#define AHX_RENDER_MAX_TICKS (50*60*60*4) /* WAV rendering and ahxGetSongDuration() give up after this (4 hours at 50Hz) */
+
 #define NOIZE_SIZE (0x280*3)
 #define WAV_FILTER_LENGTH (252 + 252 + (0x80 * 32) + NOIZE_SIZE)
 
 #define CLAMP16(i) if ((int16_t)(i) != i) i = 0x7FFF ^ (i >> 31)
 #define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+#define IN_RANGE(x, low, high) ((x) >= (low) && (x) <= (high)) /* false for NaN */
 
 // bit-rotate macros
 #define ROL32(d, x) (d = (d << (x)) | (d >> (32-(x))))
@@ -71,6 +76,33 @@ instrument_t;
 #pragma pack(pop)
 #endif
 
+/* The song decoded at load time (see ahxInitModule() in loader.c), so that the replayer
+** doesn't have to unpack track rows and perfList entries, or divide out ADSR deltas,
+** while playing. The raw tables are kept for the out-of-range reads that AHX does.
+*/
+typedef struct
+{
+	uint8_t note, instr, cmd, param;
+} trackRow_t;
+
+typedef struct
+{
+	uint8_t wave, note, cmd1, cmd2, param1, param2;
+	bool fixed;
+} perfEntry_t;
+
+typedef struct
+{
+	int16_t aDelta, dDelta, rDelta; // 8.8fp
+	uint8_t Wavelength, vibratoDepth, HardCut;
+	bool HardCutRelease;
+	uint8_t squareLowerLimit, squareUpperLimit; // sorted, and shifted for the wavelength
+	uint8_t filterSpeed, filterLowerLimit, filterUpperLimit; // sorted, with the limits' bit 7 moved into filterSpeed
+
+	// perfEntries[0] is the 4 bytes before perfList (see pListCommandParse()), perfEntries[1+n] is perfList entry n
+	perfEntry_t perfEntries[1+256];
+} instrumentData_t;
+
 typedef struct // 8bb: channel structure
 {
 	uint8_t Track;
@@ -88,6 +120,7 @@ typedef struct // 8bb: channel structure
 	int16_t rDelta; // 8 bit/8 bit floating! (8bb: 8.8fp)
 
 	instrument_t *Instrument; // ^Current_Instrument
+	const instrumentData_t *InstrumentData; // Instrument, decoded
 	uint8_t Waveform; // 1..4 (or 0..3 senseless?)
 	uint8_t Wavelength; // 0..5: 4/8/10/20/40/80 ($)
 	int16_t InstrPeriod; // !P!
@@ -164,6 +197,23 @@ typedef struct // 8bb: channel structure
 	int8_t *SquareTempBuffer;
 } plyVoiceTemp_t;
 
+typedef struct // see detectStateLoop() in replayer.c
+{
+	uint64_t stateHash; // the saved row state
+	uint32_t stateTick, rowsSinceState, rowsUntilMove;
+	uint16_t statePosNr, stateNoteNr;
+	bool found; // the saved row state is on a loop
+	uint32_t loopTicks, loopRows; // length of the loop, if found
+	uint32_t rows; // rows since the last reset, while looking for the start of a loop
+} loopDetect_t;
+
+typedef struct // a row state kept while looking for the start of a loop, see detectStateLoop()
+{
+	uint64_t hash;
+	uint32_t tick;
+	uint16_t posNr, noteNr;
+} loopRow_t;
+
 typedef struct // 8bb: song strucure
 {
 	// 8bb: added these
@@ -171,8 +221,11 @@ typedef struct // 8bb: song strucure
 	uint8_t Subsong;
 	uint16_t SongCIAPeriod;
 	int32_t loopCounter, loopTimes; // 8bb: for WAV rendering
+	uint32_t tickCounter; // ticks since ahxPlay()
+	loopDetect_t loopDetect; // for songs that loop without ever reaching the end (see replayer.c)
 	double dBPM;
 	instrument_t EmptyInstrument; // 8bb: initialized in ahxPlay()
+	instrumentData_t EmptyInstrumentData;
 	// ----------------------------
 
 	volatile bool intPlaying;
@@ -203,10 +256,24 @@ typedef struct // 8bb: song strucure
 	uint8_t *PosTable;
 	uint8_t *TrackTable;
 	instrument_t *Instruments[63];
+	trackRow_t *TrackRows; // TrackTable, decoded
+	instrumentData_t *InstrumentData[63]; // Instruments, decoded
 
-	int8_t *WaveformTab[4]; // has to be inited!!!
+	const int8_t *WaveformTab[4]; // has to be inited!!!
 } song_t;
 
+typedef struct // see ahxGetSongDuration()
+{
+	uint64_t numSamples; // output samples (stereo pairs) a WAV render of the song writes
+	uint32_t numTicks; // replayer ticks (SIDInterrupt() calls)
+	bool ended; // false if the song didn't end within AHX_RENDER_MAX_TICKS ticks
+	bool looped; // the song loops (false if it was stopped by an F00 command)
+	uint16_t loopPosNr, loopNoteNr; // position/row the loop starts at, if it loops
+	uint32_t loopTick; // first tick of the (first) loop, if it loops
+	uint64_t loopSample; // ditto, in output samples
+	uint32_t loopTicks; // length of one loop in ticks (0 if the song ended before it looped twice)
+} songDuration_t;
+
 #ifdef _MSC_VER
 #pragma pack(push)
 #pragma pack(1)
@@ -219,25 +286,180 @@ typedef struct
 	int8_t squares[0x80 * 32];
 	int8_t whiteNoiseBig[NOIZE_SIZE];
 	int8_t highPasses[WAV_FILTER_LENGTH * 31];
-
-	// 8bb: moved these here, so that they get dword-aligned
-	int8_t SquareTempBuffer[AMIGA_VOICES][0x80];
-	int8_t currentVoice[AMIGA_VOICES][0x280];
-
-	// 8bb: Added this (also put here for dword-alignment). The size is just big enough, don't change it!
-	int8_t EmptyFilterSection[0x80 * 32];
 }
 #ifdef __GNUC__
 __attribute__ ((packed))
 #endif
-waveforms_t;
+waveforms_t; // never changed once generated, can be baked in (see ahxInitWaves())
 #ifdef _MSC_VER
 #pragma pack(pop)
 #endif
 
-extern volatile bool isRecordingToWAV;
-extern song_t song;
-extern waveforms_t *waves; // 8bb: dword-aligned from malloc()
+typedef struct // the parts of the waveforms that the replayer writes to, one per context
+{
+	// 8bb: moved these here, so that they get dword-aligned
+	int8_t SquareTempBuffer[AMIGA_VOICES][0x80];
+	int8_t currentVoice[AMIGA_VOICES][0x280];
+
+	// 8bb: Added this (also put here for dword-alignment).
+	// Big enough for the furthest square an out-of-range filter position can pick (0x7F * 0x80 + 0x80)
+	int8_t EmptyFilterSection[0x80 * 0x80];
+} voiceBuffers_t;
+
+/* Context API: every ahx_context_t owns its own song, waveforms, Paula voices,
+** BLEP/filter/dither state and mix buffers, so different threads can each
+** drive their own context at the same time. A context created with
+** ahxCreateContext() is not connected to the audio driver, you pull the
+** samples yourself with paulaOutputSamplesCtx().
+*/
+
+/* masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20),
+** quality = PAULA_QUALITY_xxx (PAULA_QUALITY_BLEP is the reference, the others trade
+** aliasing for mixer time, see paula.h)
+*/
+ahx_context_t *ahxCreateContext(int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation, int32_t quality); // NULL if out of memory
+void ahxDestroyContext(ahx_context_t *ctx);
+
+bool ahxLoadFromRAMCtx(ahx_context_t *ctx, const uint8_t *data);
+bool ahxLoadCtx(ahx_context_t *ctx, const char *filename);
+void ahxFreeCtx(ahx_context_t *ctx);
+
+void ahxNextPatternCtx(ahx_context_t *ctx);
+void ahxPrevPatternCtx(ahx_context_t *ctx);
+
+bool ahxPlayCtx(ahx_context_t *ctx, int32_t subSong);
+void ahxStopCtx(ahx_context_t *ctx);
+
+// renders with the context's output rate, master volume and stereo separation
+bool ahxRecordWAVFromRAMCtx(ahx_context_t *ctx, const uint8_t *data, const char *fileOut, int32_t subSong, int32_t songLoopTimes);
+
+/* Runs the replayer only (no mixing) to get the length of a sub-song, as rendered by
+** ahxRecordWAV() with the same songLoopTimes at output rate audioFreq. The context
+** has to have a song loaded, its playback is stopped afterwards.
+*/
+bool ahxGetSongDurationCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t audioFreq, songDuration_t *duration);
+
+/* Player state snapshots, f.ex. for seeking, A/B previews or resuming long renders.
+** A snapshot is a blob of ahxGetStateSize() bytes with everything needed to continue
+** the output bit-exactly: the replayer state, Paula voices (and the buffers they play),
+** BLEP, filter and dither state, and the tick sample counter. The blob has no pointers
+** in it, it can be loaded into any context with the same song loaded and the same output
+** rate (ERR_BAD_STATE otherwise). The mixer engine and channel BLEP setting may differ,
+** but the output is only bit-exact with the ones it was saved with.
+*/
+uint32_t ahxGetStateSize(void);
+bool ahxSaveStateCtx(ahx_context_t *ctx, void *state, uint32_t stateSize);
+bool ahxLoadStateCtx(ahx_context_t *ctx, const void *state, uint32_t stateSize);
+uint64_t ahxGetSongHashCtx(ahx_context_t *ctx); // identifies the loaded song (0 if none), f.ex. to key cached seek indexes
+
+/* Seek index, for seeking anywhere in a sub-song without playing it from the start.
+** ahxCreateSeekIndexCtx() mixes the sub-song once (as long as ahxRecordWAV() would
+** render it with songLoopTimes), and saves a player state keyframe every keyframeSeconds.
+** ahxSeekCtx() then loads the keyframe before sampleOffset (in output samples from the
+** start of the sub-song) and mixes the rest, so the output continues bit-exactly as if it
+** had been played from the start. A seek index only works with the song and output rate
+** it was made with, it can be stored to disk with ahxSaveSeekIndex(). Its size is about
+** 7.5kB per keyframe. After ahxCreateSeekIndexCtx(), the context is at the start of the
+** sub-song (as after ahxPlayCtx()).
+*/
+typedef struct ahxSeekIndex_t ahxSeekIndex_t;
+
+ahxSeekIndex_t *ahxCreateSeekIndexCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t keyframeSeconds); // NULL on error
+bool ahxSeekCtx(ahx_context_t *ctx, const ahxSeekIndex_t *index, uint64_t sampleOffset);
+void ahxFreeSeekIndex(ahxSeekIndex_t *index);
+uint64_t ahxGetSeekIndexLength(const ahxSeekIndex_t *index); // in output samples
+bool ahxSaveSeekIndex(const ahxSeekIndex_t *index, const char *filename);
+ahxSeekIndex_t *ahxLoadSeekIndex(const char *filename); // NULL if the file is not a seek index, is damaged (or out of memory)
+
+/* Fast-forward seeking without a seek index. ahxSeekTicksCtx() plays on for numTicks
+** replayer ticks (after the rest of the current one), but only mixes the last ~3 seconds
+** of them, and then sounds as if all of them had been mixed (the filters have converged,
+** but aren't bit-identical to a full render). Minutes of song take milliseconds.
+** ahxSeekToPositionCtx() restarts the sub-song and fast-forwards to where the position/row
+** is about to be played, false if the song loops or ends before it gets there (it's left
+** at the start then). A position/row outside the song gives ERR_BAD_POSITION.
+*/
+bool ahxSeekTicksCtx(ahx_context_t *ctx, uint32_t numTicks);
+bool ahxSeekToPositionCtx(ahx_context_t *ctx, int32_t posNr, int32_t noteNr);
+
+/* Parallel WAV rendering of one sub-song, bit-identical to ahxRecordWAV() with the same
+** settings. ahxCreateRenderJobCtx() runs the replayer once without mixing (fast) and keeps
+** a full player state checkpoint a few seconds before each of numChunks chunks, the context
+** is stopped afterwards. ahxRenderJobChunkCtx() then mixes one chunk into the job's output
+** buffer: different threads can render different chunks at the same time, each with its
+** own context with the same song loaded and the same output rate, master volume, stereo
+** separation, mixer quality, engine and BLEP settings (ERR_BAD_STATE otherwise).
+** ahxFinishRenderJobCtx() renders the chunks that are left, and checks every seam (the few
+** chunks that didn't start bit-exactly are rendered again). The job holds the whole render
+** in memory (4 bytes per output sample) plus about 22kB per chunk.
+*/
+typedef struct ahxRenderJob_t ahxRenderJob_t;
+
+ahxRenderJob_t *ahxCreateRenderJobCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes, int32_t numChunks); // NULL on error
+bool ahxRenderJobChunkCtx(ahx_context_t *ctx, ahxRenderJob_t *job, int32_t chunk); // chunk = 0 .. ahxGetRenderJobChunks()-1
+bool ahxFinishRenderJobCtx(ahx_context_t *ctx, ahxRenderJob_t *job);
+void ahxFreeRenderJob(ahxRenderJob_t *job);
+int32_t ahxGetRenderJobChunks(const ahxRenderJob_t *job); // can be less than asked for (very short songs)
+const int16_t *ahxGetRenderJobOutput(const ahxRenderJob_t *job, uint64_t *numSamples); // stereo, complete after ahxFinishRenderJobCtx()
+bool ahxSaveRenderJobWAV(const ahxRenderJob_t *job, const char *filename);
+
+const song_t *ahxGetSongCtx(ahx_context_t *ctx);
+bool ahxIsRecordingWAVCtx(ahx_context_t *ctx);
+void ahxSetRecordingWAVCtx(ahx_context_t *ctx, bool recording); // false = stop ongoing WAV rendering
+int32_t ahxGetErrorCodeCtx(ahx_context_t *ctx);
+
+/* AHX copies a voice's waveform to its voice buffer every time it changes (every frame for
+** noise). By default, Paula is pointed at a ready-made image of the waveform instead, at
+** the same position in it, which plays exactly the same. copy = true copies them like AHX
+** does, f.ex. to compare the two. Can be changed at any time.
+*/
+void ahxSetWaveformCopyingCtx(ahx_context_t *ctx, bool copy); // false = zero-copy (default)
+
+void SIDInterruptCtx(ahx_context_t *ctx); // replayer ticker
+
+/* Lookahead mode, to run the replayer on its own thread instead of in the audio callback.
+** With numTicks > 0, the mixer no longer runs replayer ticks itself. Another thread calls
+** ahxRunLookaheadCtx() every few milliseconds, which runs the replayer ahead until numTicks
+** ticks of Paula writes (periods, volumes and voice buffer contents) are queued (returns
+** how many it made), and the mixer only applies one of those per tick. The output is the
+** same as without a lookahead, as long as the thread keeps up (a tick that isn't there in
+** time is late, see audio_t.lookaheadUnderruns). The song state (position etc.) runs up to
+** numTicks ahead of what's heard, but the replayer state from before every queued tick is
+** kept, so saving a state, seeking and changing pattern go from the tick that's heard.
+** Playing, stopping, seeking, changing pattern, loading a state and changing the lookahead
+** drop the queued ticks. Stop the thread before changing the lookahead or closing.
+*/
+bool ahxSetLookaheadCtx(ahx_context_t *ctx, int32_t numTicks); // 0 = off (default)
+int32_t ahxRunLookaheadCtx(ahx_context_t *ctx); // only from one thread at a time
+
+/* Paula traces. A rendered sub-song is nothing more than the Paula writes the replayer
+** makes on every tick (periods, volumes and voice buffer contents), and a trace is those
+** writes, delta-compressed: only what changed from the tick before is stored, and buffer
+** contents as one waveform cycle, either as a reference into the waveform tables or as the
+** bytes that changed. That's typically 1-2kB per second of song.
+** ahxCreateTraceCtx() runs the replayer once without mixing (as long as ahxRecordWAV()
+** would render the sub-song with songLoopTimes), the context is stopped afterwards.
+** ahxPlayTraceCtx() plays a trace in any context, no song has to be loaded: it takes the
+** place of the replayer (also in lookahead mode), until the trace ends or ahxStopCtx()/
+** ahxPlayCtx() is called. The trace must be kept until then. The output is bit-identical
+** to playing the song with the context's output rate, stereo separation and mixer settings.
+** ahxRecordTraceWAVCtx() renders a trace like ahxRecordWAV() renders a song.
+*/
+typedef struct ahxTrace_t ahxTrace_t;
+
+ahxTrace_t *ahxCreateTraceCtx(ahx_context_t *ctx, int32_t subSong, int32_t songLoopTimes); // NULL on error
+void ahxFreeTrace(ahxTrace_t *trace);
+uint32_t ahxGetTraceTicks(const ahxTrace_t *trace);
+uint32_t ahxGetTraceSize(const ahxTrace_t *trace); // in bytes, as stored
+bool ahxSaveTrace(const ahxTrace_t *trace, const char *filename);
+ahxTrace_t *ahxLoadTrace(const char *filename); // NULL if the file is not a trace (or out of memory)
+ahxTrace_t *ahxLoadTraceFromRAM(const uint8_t *data, uint32_t dataSize);
+bool ahxPlayTraceCtx(ahx_context_t *ctx, const ahxTrace_t *trace);
+bool ahxRecordTraceWAVCtx(ahx_context_t *ctx, const ahxTrace_t *trace, const char *fileOut);
+
+/* The context-less API below operates on a built-in default context.
+** ahxInit() connects that one to the audio driver.
+*/
 
 // loader.c
 bool ahxLoadFromRAM(const uint8_t *data);
@@ -249,7 +471,8 @@ void ahxNextPattern(void);
 void ahxPrevPattern(void);
 
 // 8bb: masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
-bool ahxInit(int32_t audioFreq, int32_t audioBufferSize, int32_t masterVol, int32_t stereoSeparation);
+// quality = PAULA_QUALITY_xxx (default = PAULA_QUALITY_BLEP)
+bool ahxInit(int32_t audioFreq, int32_t audioBufferSize, int32_t masterVol, int32_t stereoSeparation, int32_t quality);
 
 void ahxClose(void);
 
@@ -266,6 +489,29 @@ bool ahxRecordWAVFromRAM(const uint8_t *data, const char *fileOut, int32_t subSo
 bool ahxRecordWAV(const char *fileIn, const char *fileOut, int32_t subSong,
 	int32_t songLoopTimes, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation);
 
+bool ahxGetSongDuration(int32_t subSong, int32_t songLoopTimes, int32_t audioFreq, songDuration_t *duration); // stops playback
+
+bool ahxSaveState(void *state, uint32_t stateSize); // see ahxSaveStateCtx()
+bool ahxLoadState(const void *state, uint32_t stateSize);
+uint64_t ahxGetSongHash(void);
+ahxSeekIndex_t *ahxCreateSeekIndex(int32_t subSong, int32_t songLoopTimes, int32_t keyframeSeconds); // see ahxCreateSeekIndexCtx()
+bool ahxSeek(const ahxSeekIndex_t *index, uint64_t sampleOffset);
+bool ahxSeekTicks(uint32_t numTicks); // see ahxSeekTicksCtx()
+bool ahxSeekToPosition(int32_t posNr, int32_t noteNr);
+ahxRenderJob_t *ahxCreateRenderJob(int32_t subSong, int32_t songLoopTimes, int32_t numChunks); // see ahxCreateRenderJobCtx()
+bool ahxFinishRenderJob(ahxRenderJob_t *job);
+
+const song_t *ahxGetSong(void);
+bool ahxIsRecordingWAV(void);
+void ahxSetRecordingWAV(bool recording);
 int32_t ahxGetErrorCode(void);
+void ahxSetWaveformCopying(bool copy); // see ahxSetWaveformCopyingCtx()
 
 void SIDInterrupt(void); // 8bb: replayer ticker
+bool ahxSetLookahead(int32_t numTicks); // see ahxSetLookaheadCtx()
+int32_t ahxRunLookahead(void);
+ahxTrace_t *ahxCreateTrace(int32_t subSong, int32_t songLoopTimes); // see ahxCreateTraceCtx()
+bool ahxPlayTrace(const ahxTrace_t *trace);
+
+// masterVol = 0..256 (default = 256), stereoSeparation = 0..100 (percentage, default = 20)
+bool ahxRecordTraceWAV(const ahxTrace_t *trace, const char *fileOut, int32_t audioFreq, int32_t masterVol, int32_t stereoSeparation);
@@ -0,0 +1,86 @@
+/*
+** Writes the waveform tables (see waves.c) to a C file, to bake them into the binary:
+** build the player with that file and AHX_BAKED_WAVES defined, and the contexts use
+** the baked tables instead of generating their own (see ahxInitWaves() in loader.c).
+** The make scripts in ahx2play do this.
+**
+** Usage: genwaves <output.c> (put it next to ahxcontext.h)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../ahxcontext.h"
+
+static void writeTable(FILE *f, const char *name, const int8_t *data, int32_t length)
+{
+	fprintf(f, "\t{ // %s\n", name);
+
+	for (int32_t i = 0; i < length; i++)
+	{
+		fprintf(f, ((i & 31) == 0) ? "\t\t%d," : "%d,", data[i]);
+		if ((i & 31) == 31 || i == length-1)
+			fputc('\n', f);
+	}
+
+	fprintf(f, "\t},\n");
+}
+
+#define WRITE_TABLE(x) writeTable(f, #x, waves->x, sizeof (waves->x))
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2)
+	{
+		printf("Usage: genwaves <output.c>\n");
+		return 1;
+	}
+
+	waveforms_t *waves = (waveforms_t *)malloc(sizeof (waveforms_t));
+	if (waves == NULL)
+	{
+		printf("Error: Out of memory!\n");
+		return 1;
+	}
+
+	ahxGenerateWaves(waves);
+
+	FILE *f = fopen(argv[1], "w");
+	if (f == NULL)
+	{
+		printf("Error: Couldn't open \"%s\" for writing!\n", argv[1]);
+		free(waves);
+		return 1;
+	}
+
+	fprintf(f, "// generated by tools/genwaves.c, don't edit\n\n");
+	fprintf(f, "#include \"ahxcontext.h\"\n\n");
+	fprintf(f, "#ifdef AHX_BAKED_WAVES\n\n");
+	fprintf(f, "#ifdef _MSC_VER\n__declspec(align(4))\n#endif\n");
+	fprintf(f, "const waveforms_t ahxBakedWaves\n");
+	fprintf(f, "#ifdef __GNUC__\n__attribute__ ((aligned (4)))\n#endif\n");
+	fprintf(f, "=\n{\n");
+
+	WRITE_TABLE(lowPasses);
+	WRITE_TABLE(triangle04); WRITE_TABLE(triangle08); WRITE_TABLE(triangle10);
+	WRITE_TABLE(triangle20); WRITE_TABLE(triangle40); WRITE_TABLE(triangle80);
+	WRITE_TABLE(sawtooth04); WRITE_TABLE(sawtooth08); WRITE_TABLE(sawtooth10);
+	WRITE_TABLE(sawtooth20); WRITE_TABLE(sawtooth40); WRITE_TABLE(sawtooth80);
+	WRITE_TABLE(squares);
+	WRITE_TABLE(whiteNoiseBig);
+	WRITE_TABLE(highPasses);
+
+	fprintf(f, "};\n\n#endif\n");
+
+	const bool ok = !ferror(f);
+	if (fclose(f) != 0 || !ok)
+	{
+		printf("Error: Couldn't write \"%s\"!\n", argv[1]);
+		free(waves);
+		return 1;
+	}
+
+	free(waves);
+	return 0;
+}